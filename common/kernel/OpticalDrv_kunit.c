@@ -0,0 +1,18 @@
+// KUnit suite of the driver core with the 2-camera descriptor, see TouchDrvCore_kunit.c
+
+#define TOUCH_HEADER            "OpticalDrv.h"
+#define TOUCH_TRACE_SYSTEM      optical_kunit
+#define TOUCH_TRACE_EVENT(name) optical_kunit_##name
+#define TOUCH_TYPE(name)        Optical##name
+#define TOUCH_CONST(name)       OPTICAL_##name
+
+#define TOUCH_DEVICE_IDS                \
+    { USB_DEVICE(0x6615, 0x0084) }
+
+#define DRIVER_NAME             "IRTOUCH optical KUnit"
+#define DRIVER_DESCRIPTION      "KUnit tests of the touch driver core, 2-camera variant"
+#define DRIVER_AUTHOR           "KOGA"
+
+#define TOUCH_KUNIT_SUITE       "optical_drv_core"
+
+#include "TouchDrvCore_kunit.c"
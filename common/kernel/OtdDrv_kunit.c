@@ -0,0 +1,18 @@
+// KUnit suite of the driver core with the 4-camera descriptor, see TouchDrvCore_kunit.c
+
+#define TOUCH_HEADER            "OtdDrv.h"
+#define TOUCH_TRACE_SYSTEM      otd_kunit
+#define TOUCH_TRACE_EVENT(name) otd_kunit_##name
+#define TOUCH_TYPE(name)        Otd##name
+#define TOUCH_CONST(name)       OTD_##name
+
+#define TOUCH_DEVICE_IDS                \
+    { USB_DEVICE(0x2621, 0x2201) }
+
+#define DRIVER_NAME             "Optical touch device KUnit"
+#define DRIVER_DESCRIPTION      "KUnit tests of the touch driver core, 4-camera variant"
+#define DRIVER_AUTHOR           "Optical touch screen"
+
+#define TOUCH_KUNIT_SUITE       "otd_drv_core"
+
+#include "TouchDrvCore_kunit.c"
@@ -0,0 +1,3266 @@
+// Driver core shared by the 2-camera (touch2) and 4-camera (touch4) modules.
+// It is not built on its own: each variant source defines the descriptor
+// below and includes this file, so the touch-point count and the packet
+// layout are compile-time constants of the module being built.
+//
+//   TOUCH_HEADER          ABI header of the variant, e.g. "OtdDrv.h"
+//   TOUCH_TRACE_SYSTEM    trace system of the variant's tracepoints
+//   TOUCH_TRACE_EVENT(name) pastes the variant's tracepoint prefix onto name
+//   TOUCH_TYPE(name)      pastes the variant's type prefix onto name
+//   TOUCH_CONST(name)     pastes the variant's constant prefix onto name
+//   TOUCH_DEVICE_IDS      USB_DEVICE() entries of the device table
+//   DRIVER_NAME, DRIVER_DESCRIPTION, DRIVER_AUTHOR
+//
+// TOUCH_KUNIT, defined by TouchDrvCore_kunit.c, leaves out the module entry
+// points and the device table, so the test module never binds a board.
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/errno.h>
+#include <linux/usb.h>
+#include <linux/input.h>
+#include <linux/usb/input.h>
+#include <linux/hid.h>
+#include <linux/delay.h>
+#include <linux/cdev.h>
+#include <asm/uaccess.h>
+#include <linux/input/mt.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/pm_runtime.h>
+#include <linux/seqlock.h>
+#include <linux/debugfs.h>
+#include <linux/version.h>
+
+#include TOUCH_HEADER
+
+#define CREATE_TRACE_POINTS
+#include "TouchDrvCore_trace.h"
+
+#define TOUCH_TRACE_PASTE_(a, b)    a##b
+#define TOUCH_TRACE_PASTE(a, b)     TOUCH_TRACE_PASTE_(a, b)
+// trace_<prefix>_name, the tracepoint call of the variant
+#define TOUCH_TRACE(name)           TOUCH_TRACE_PASTE(trace_, TOUCH_TRACE_EVENT(name))
+
+#define err(format, arg...)                \
+    printk(KERN_ERR KBUILD_MODNAME ": " format "\n", ##arg)
+#define info(format, arg...)                \
+    printk(KERN_INFO KBUILD_MODNAME ": " format "\n", ##arg)
+#define warn(format, arg...)                \
+    printk(KERN_WARNING KBUILD_MODNAME ": " format "\n", ##arg)
+
+typedef TOUCH_TYPE(ReportTouchPoint) report_touch_point;
+typedef TOUCH_TYPE(ReportPacketSingleTouch) report_packet_single_touch;
+typedef TOUCH_TYPE(ReportPacketMultiTouch) report_packet_multi_touch;
+typedef TOUCH_TYPE(ReportSparseTouchPoint) report_sparse_touch_point;
+typedef TOUCH_TYPE(ReportPacketSparseMultiTouch) report_packet_sparse_multi_touch;
+typedef TOUCH_TYPE(ReportRingSlot) report_ring_slot;
+typedef TOUCH_TYPE(ReportRing) report_ring;
+typedef TOUCH_TYPE(DiagnosticHeader) diagnostic_header;
+
+#define TOUCH_POINT_IS_VALID        TOUCH_TYPE(ReportTouchPointStateFlag_IsValid)
+#define TOUCH_POINT_IS_TOUCHED      TOUCH_TYPE(ReportTouchPointStateFlag_IsTouched)
+#define TOUCH_POINT_COUNT           TOUCH_CONST(TOUCH_POINT_COUNT)
+#define TOUCH_REPORT_SIZE           TOUCH_CONST(REPORT_SIZE)
+#define TOUCH_IOCTL_CODE(name)      TOUCH_CONST(IOCTL_CODE_##name)
+#define TOUCH_READ_FORMAT_RAW           TOUCH_CONST(READ_FORMAT_RAW)
+#define TOUCH_READ_FORMAT_TIMESTAMPED   TOUCH_CONST(READ_FORMAT_TIMESTAMPED)
+
+// Slot loops run TOUCH_POINT_COUNT times; have them unrolled for the variant.
+#if defined(__clang__)
+#define TOUCH_POINT_LOOP            _Pragma("unroll")
+#elif __GNUC__ >= 8
+#define TOUCH_POINT_LOOP            _Pragma("GCC unroll 16")
+#else
+#define TOUCH_POINT_LOOP
+#endif
+
+#define TOUCH_MINOR_BASE    0
+
+#define TOUCH_REPORT_QUEUE_DEPTH_MAX    1024
+#define TOUCH_INTERRUPT_URB_MAX         16
+#define TOUCH_FRAME_TIME_WINDOW_NS      (20 * NSEC_PER_MSEC)
+// URB errors in a row, without a report in between, before the endpoint gets reset
+#define TOUCH_URB_ERROR_BURST_MAX       32
+// failed recovery attempts, backing off 2, 4, ... ms, before the device gets reset
+#define TOUCH_RECOVERY_ATTEMPTS_MAX     8
+// recovery_flags bits
+#define TOUCH_RECOVERY_CLEAR_HALT       0
+// bucket 0 counts values below 1, bucket n values in [2^(n-1), 2^n), the last one everything above
+#define TOUCH_HISTOGRAM_BUCKETS         20
+#define TOUCH_IOCTL_TYPE_COUNT          ((TOUCH_IOCTL_CODE(TYPE_MASK) >> 16) + 1)
+// SET_REPORT/GET_REPORT up to this length use the preallocated buffer, it is
+// also the limit of asynchronous transfers
+#define TOUCH_CONTROL_BUFFER_SIZE       4096
+#define TOUCH_CONTROL_TIMEOUT_MS        1000
+// read-only blocks cached for FLAG_CACHED, keyed by a SET_REPORT payload of at most KEY_SIZE
+#define TOUCH_CONTROL_CACHE_ENTRIES     16
+#define TOUCH_CONTROL_CACHE_KEY_SIZE    64
+// calibration_matrix entries are Q16.16 fixed point
+#define TOUCH_CALIBRATION_SHIFT         16
+#define TOUCH_CALIBRATION_ONE           (1 << TOUCH_CALIBRATION_SHIFT)
+// the range advertised for every ABS_MT_* axis but the pressure
+#define TOUCH_AXIS_MAX                  32767
+// jitter filter: smoothing factors are Q16, positions carry 8 fraction bits
+#define TOUCH_FILTER_ALPHA_SHIFT        16
+#define TOUCH_FILTER_VALUE_SHIFT        8
+// frame intervals beyond this are taken as this, e.g. after a pause
+#define TOUCH_FILTER_INTERVAL_MAX_US    (100 * USEC_PER_MSEC)
+#define TOUCH_FILTER_SPEED_MAX          S32_MAX
+// prediction: positions kept per slot, and how many a stroke needs before it is extrapolated
+#define TOUCH_PREDICT_HISTORY           4
+#define TOUCH_PREDICT_FRAMES_MIN        3
+#define TOUCH_PREDICT_HORIZON_MAX_US    (50 * USEC_PER_MSEC)
+// the diagnostics ring holds at least two records of the largest size
+#define TOUCH_DIAGNOSTICS_KB_MIN        256
+#define TOUCH_DIAGNOSTICS_KB_MAX        65536
+
+static unsigned int report_queue_depth = 64;
+module_param(report_queue_depth, uint, 0444);
+MODULE_PARM_DESC(report_queue_depth, "Raw reports buffered per device, rounded up to a power of two (default 64)");
+
+static unsigned int interrupt_urb_count = 4;
+module_param(interrupt_urb_count, uint, 0444);
+MODULE_PARM_DESC(interrupt_urb_count, "Interrupt URBs kept queued per device so no polling interval is missed (default 4)");
+
+static unsigned int scan_time_unit_us = 100;
+module_param(scan_time_unit_us, uint, 0644);
+MODULE_PARM_DESC(scan_time_unit_us, "Unit of the scanTime field in microseconds, used to space input event timestamps; 0 uses the report capture time only (default 100)");
+
+static bool latest_report_only;
+module_param(latest_report_only, bool, 0644);
+MODULE_PARM_DESC(latest_report_only, "Let read() return only the newest raw report and drop older ones, as old servers expect");
+
+static bool nonblocking_read;
+module_param(nonblocking_read, bool, 0644);
+MODULE_PARM_DESC(nonblocking_read, "Let read() return 0 at once when no report is queued, even without O_NONBLOCK");
+
+static unsigned int settle_delay_ms;
+module_param(settle_delay_ms, uint, 0644);
+MODULE_PARM_DESC(settle_delay_ms, "Delay in milliseconds between probe and the creation of the device node, for boards that need time to settle; probe itself never waits (default 0)");
+
+static unsigned int diagnostics_kb = 1024;
+module_param(diagnostics_kb, uint, 0444);
+MODULE_PARM_DESC(diagnostics_kb, "Size of the debugfs diagnostics stream buffer per device in KiB, rounded up to a power of two and allocated on first use (default 1024)");
+
+// negative leaves power/control to the kernel default and udev
+static int autosuspend_delay = -1;
+module_param(autosuspend_delay, int, 0444);
+MODULE_PARM_DESC(autosuspend_delay, "Seconds without reports before an idle board is suspended, a touch wakes it again; negative leaves the autosuspend policy to userspace (default -1)");
+
+typedef struct _device_context_pool
+{
+    char name[128];
+    char phys[64];
+}
+device_context_pool;
+
+// URB statuses counted separately, anything else lands in the last urb_errors entry
+static int const urb_error_status[] = { -EPIPE, -EPROTO, -EILSEQ, -ETIME, -EOVERFLOW, -EREMOTEIO };
+
+// updated without locks from any context, cleared through statistics/reset
+typedef struct _device_statistics
+{
+    atomic_long_t reports_received;
+    atomic_long_t urb_errors[ARRAY_SIZE(urb_error_status) + 1];
+    atomic_long_t resubmit_failures;
+    atomic_long_t halts_cleared;
+    atomic_long_t urbs_recovered;
+    atomic_long_t device_resets;
+    atomic_long_t reads;
+    atomic_long_t listener_overflow;
+    atomic_long_t suspends;
+    atomic_long_t resumes;
+    atomic_long_t control_cache_hits;
+    atomic_long_t predictions;
+    atomic_long_t diagnostic_records;
+    atomic_long_t diagnostic_overwritten;
+    atomic_long_t reports_replayed;
+    atomic_long_t ioctls[TOUCH_IOCTL_TYPE_COUNT];
+    atomic_long_t report_interval[TOUCH_HISTOGRAM_BUCKETS];
+    atomic_long_t report_to_sync[TOUCH_HISTOGRAM_BUCKETS];
+    atomic_long_t resume_to_report[TOUCH_HISTOGRAM_BUCKETS];
+    // distance in device units between a prediction and the position at its target time
+    atomic_long_t prediction_error[TOUCH_HISTOGRAM_BUCKETS];
+    // everything above is an atomic_long_t cleared by statistics/reset
+    // completion time of the previous report and time of the last resume
+    // that has not seen a report yet, guarded by device_context::lock
+    ktime_t last_report_time;
+    ktime_t resume_time;
+}
+device_statistics;
+
+// GET_REPORT response to the SET_REPORT payload in key, for a length of length
+typedef struct _control_cache_entry
+{
+    unsigned short key_length;
+    unsigned short length;
+    unsigned char key[TOUCH_CONTROL_CACHE_KEY_SIZE];
+    unsigned int data_length;
+    void* data;
+}
+control_cache_entry;
+
+// Row-major 3x3 affine transform of the contacts reported to input_dev, in
+// Q16.16. The last row is always 0 0 1; the translations are Q16.16 as well,
+// 65536 per device unit.
+typedef struct _calibration_matrix
+{
+    s32 m[9];
+    bool identity;
+}
+calibration_matrix;
+
+// 1 euro filter parameters, see filter_axis_update(); min_cutoff_mhz 0 disables it
+typedef struct _filter_params
+{
+    unsigned int min_cutoff_mhz;
+    unsigned int beta;
+    unsigned int d_cutoff_mhz;
+}
+filter_params;
+
+// filter state of one slot axis, valid while the slot is touching
+typedef struct _filter_axis
+{
+    s32 value;
+    s64 speed;
+}
+filter_axis;
+
+// Recent positions of one slot, after the jitter filter, and the last
+// prediction made from them until the stroke reaches its target time.
+typedef struct _predict_slot
+{
+    s32 x[TOUCH_PREDICT_HISTORY];
+    s32 y[TOUCH_PREDICT_HISTORY];
+    ktime_t time[TOUCH_PREDICT_HISTORY];
+    unsigned int count;
+    unsigned int newest;
+    bool pending;
+    s32 predicted_x;
+    s32 predicted_y;
+    ktime_t target;
+}
+predict_slot;
+
+typedef struct _device_context
+{
+    struct usb_device *usb_device;
+    struct usb_interface* interface;
+    struct input_dev *input_dev;
+    struct device* device;
+    dev_t dev;
+    // the device node is created by ready_work once the board has settled
+    bool node_registered;
+    ktime_t probe_time;
+    long probe_to_ready_us;
+    struct delayed_work ready_work;
+    // open file owning mmap() and the sync control codes, guarded by io_mutex
+    struct _file_context* primary;
+    struct kref kref;
+    struct mutex io_mutex;
+    bool disconnected;
+    int pipe_input;
+    unsigned char pipe_interval;
+
+    // each URB owns a coherent TOUCH_REPORT_SIZE transfer buffer
+    struct urb* interrupt_urb[TOUCH_INTERRUPT_URB_MAX];
+    unsigned int interrupt_urb_count;
+
+    // URB error recovery: bit n of parked_urbs is set while interrupt_urb[n]
+    // is left unqueued after an error, recovery_work queues it again
+    bool streaming;
+    bool suspended;
+    unsigned long parked_urbs;
+    unsigned long recovery_flags;
+    atomic_t urb_error_burst;
+    unsigned int recovery_attempts;
+    struct delayed_work recovery_work;
+    // serializes streaming changes of open/close with resume
+    struct mutex pm_mutex;
+
+    // SET_REPORT/GET_REPORT state, guarded by control_mutex so a slow transfer
+    // never holds io_mutex. control_buffer belongs to control_urb from an
+    // asynchronous submission until GET_CONTROL_RESULT collects it.
+    struct mutex control_mutex;
+    unsigned char* control_buffer;
+    struct usb_ctrlrequest* control_setup;
+    struct urb* control_urb;
+    struct delayed_work control_timeout_work;
+    bool control_submitted;
+    bool control_in;
+    // written by the completion, control_done is also read by poll()
+    bool control_done;
+    bool control_timed_out;
+    int control_status;
+    // FLAG_CACHED: the block the last SET_REPORT selected and whether it went to the device
+    unsigned short control_key_length;
+    bool control_key_sent;
+    unsigned char control_key[TOUCH_CONTROL_CACHE_KEY_SIZE];
+    control_cache_entry control_cache[TOUCH_CONTROL_CACHE_ENTRIES];
+    unsigned int control_cache_next;
+
+    spinlock_t lock;
+
+    // raw report ring, see report_ring; the producer side is guarded by lock
+    report_ring* ring;
+    unsigned long ring_size;
+    bool ring_mapped;
+    report_ring_slot* queue;
+    unsigned int queue_mask;
+    unsigned int queue_head;
+    // reports the ring dropped, guarded by lock; ring->overflow is only a copy
+    // for the mapping reader, which could overwrite it
+    unsigned int queue_overflow;
+    unsigned int report_sequence;
+    wait_queue_head_t queue_wait;
+    // listeners are woken for every report, the primary only on an empty ring
+    wait_queue_head_t listener_wait;
+
+    // timestamp and scanTime of the last reported input frame, guarded by io_mutex
+    ktime_t frame_time;
+    unsigned short frame_scan_time;
+    // bit n set while slot n is reported as touching, guarded by io_mutex
+    unsigned int active_slots;
+
+    // read once per frame, so a frame is transformed by one matrix only
+    seqlock_t calibration_lock;
+    calibration_matrix calibration;
+
+    // jitter filter parameters set through sysfs, the state and the time of
+    // the last frame are guarded by io_mutex
+    filter_params filter;
+    filter_axis filter_state[TOUCH_POINT_COUNT][2];
+    // bit n is set while filter_state[n] follows the stroke in slot n
+    unsigned int filtered_slots;
+    ktime_t filter_time;
+
+    // prediction horizon set through sysfs, 0 when off; state guarded by io_mutex
+    unsigned int predict_horizon_us;
+    predict_slot predict[TOUCH_POINT_COUNT];
+
+    device_statistics statistics;
+
+    // SYNC_MULTITOUCH_BATCH staging area, allocated on first use and guarded by io_mutex
+    report_packet_multi_touch* batch;
+
+    // Diagnostics stream, a byte ring of records allocated on first use. The
+    // single producer holds diagnostics_mutex; readers take no lock and check
+    // after each copy that tail has not passed the record they copied.
+    struct mutex diagnostics_mutex;
+    unsigned char* diagnostics;
+    unsigned long diagnostics_mask;
+    unsigned long diagnostics_head;
+    unsigned long diagnostics_tail;
+    unsigned int diagnostics_sequence;
+    wait_queue_head_t diagnostics_wait;
+    struct dentry* debugfs_dir;
+    // pace of debugfs replay in percent of the captured one, 0 for no pacing
+    u32 replay_speed;
+    // replay writers sleep here until their next record is due or the device is gone
+    wait_queue_head_t replay_queue;
+
+    device_context_pool pool;
+}
+device_context;
+
+// One per open file. The primary consumes the ring through its tail, a
+// listener follows the stream with its own cursor and never holds up the
+// primary: it just loses what the producer overwrites before it reads it.
+typedef struct _file_context
+{
+    device_context* device;
+    bool primary;
+    unsigned int read_format;
+    // listener position and lost reports, guarded by device_context::lock
+    unsigned int cursor;
+    unsigned int overflow;
+}
+file_context;
+
+
+static struct usb_device_id const dev_table[] =
+{
+    TOUCH_DEVICE_IDS,
+    {}
+};
+
+static struct usb_driver touch_driver;
+static struct file_operations touch_fops;
+static struct usb_class_driver touch_class = {
+    .name = DEVICE_NODE_FORMAT,
+    .fops = &touch_fops,
+    .minor_base = TOUCH_MINOR_BASE,
+};
+
+static void interrupt_urbs_free(device_context* device)
+{
+    struct urb* urb;
+    unsigned int i;
+
+    for (i = 0; i < TOUCH_INTERRUPT_URB_MAX; i++)
+    {
+        urb = device->interrupt_urb[i];
+        if (urb == NULL)
+        {
+            continue;
+        }
+        usb_free_coherent(device->usb_device, TOUCH_REPORT_SIZE, urb->transfer_buffer, urb->transfer_dma);
+        usb_free_urb(urb);
+        device->interrupt_urb[i] = NULL;
+    }
+}
+
+static void control_free(device_context* device)
+{
+    unsigned int i;
+
+    for (i = 0; i < TOUCH_CONTROL_CACHE_ENTRIES; i++)
+    {
+        kfree(device->control_cache[i].data);
+    }
+    usb_free_urb(device->control_urb);
+    kfree(device->control_setup);
+    kfree(device->control_buffer);
+}
+
+static void touch_delete(struct kref* kref)
+{
+    device_context* device;
+
+    device = container_of(kref, device_context, kref);
+    control_free(device);
+    interrupt_urbs_free(device);
+    vfree(device->ring);
+    kvfree(device->batch);
+    vfree(device->diagnostics);
+    usb_put_dev(device->usb_device);
+    kfree(device);
+}
+
+static void histogram_add(atomic_long_t* histogram, s64 value)
+{
+    unsigned int bucket;
+
+    bucket = 0;
+    if (value > 0)
+    {
+        bucket = min_t(unsigned int, fls64(value), TOUCH_HISTOGRAM_BUCKETS - 1);
+    }
+    atomic_long_inc(&histogram[bucket]);
+}
+
+static void count_urb_error(device_context* device, int status)
+{
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(urb_error_status); i++)
+    {
+        if (urb_error_status[i] == status)
+        {
+            break;
+        }
+    }
+    atomic_long_inc(&device->statistics.urb_errors[i]);
+}
+
+// The tail sits in the page the primary may map writable, so it is only
+// trusted as far as it points at a report still in the ring.
+static unsigned int report_queue_tail(device_context* device)
+{
+    unsigned int head;
+    unsigned int tail;
+
+    head = READ_ONCE(device->queue_head);
+    tail = READ_ONCE(device->ring->tail);
+    if (head - tail > device->queue_mask + 1)
+    {
+        // ahead of head, or behind the oldest report in the ring
+        tail = (int)(head - tail) < 0 ? head : head - (device->queue_mask + 1);
+    }
+    return tail;
+}
+static unsigned int report_queue_count(device_context* device)
+{
+    return READ_ONCE(device->queue_head) - report_queue_tail(device);
+}
+
+// sequence number of the report the reader consumed last
+static unsigned int consumed_sequence(device_context* device)
+{
+    return READ_ONCE(device->queue[(READ_ONCE(device->ring->tail) - 1) & device->queue_mask].header.sequence);
+}
+
+// fails only when not a single URB could be queued, a partial pool still delivers reports
+static int submit_urb(device_context* device, gfp_t gfp)
+{
+    unsigned int i;
+    int retval;
+
+    // the host controller completes URBs of one endpoint in submission order
+    for (i = 0; i < device->interrupt_urb_count; i++)
+    {
+        retval = usb_submit_urb(device->interrupt_urb[i], gfp);
+        if (TOUCH_TRACE(urb_submit_enabled)())
+        {
+            TOUCH_TRACE(urb_submit)(device->usb_device, device->report_sequence, report_queue_count(device), retval);
+        }
+        if (retval != 0)
+        {
+            atomic_long_inc(&device->statistics.resubmit_failures);
+            err("%s - usb_submit_urb failed, error %d", __func__, retval);
+            if (i == 0)
+            {
+                return retval;
+            }
+            // recovery_work queues the rest of the pool
+            for (; i < device->interrupt_urb_count; i++)
+            {
+                set_bit(i, &device->parked_urbs);
+            }
+            schedule_delayed_work(&device->recovery_work, 0);
+            return 0;
+        }
+    }
+    return 0;
+}
+static void cancel_urb(device_context* device)
+{
+    unsigned int i;
+
+    for (i = 0; i < device->interrupt_urb_count; i++)
+    {
+        usb_kill_urb(device->interrupt_urb[i]);
+    }
+}
+
+static unsigned int report_queue_alloc(device_context* device)
+{
+    unsigned int depth;
+    unsigned long size;
+
+    depth = clamp_t(unsigned int, report_queue_depth, 1, TOUCH_REPORT_QUEUE_DEPTH_MAX);
+    depth = roundup_pow_of_two(depth);
+    size = PAGE_SIZE + PAGE_ALIGN(depth * sizeof(report_ring_slot));
+    device->ring = vmalloc_user(size);
+    if (device->ring == NULL)
+    {
+        return 0;
+    }
+    device->ring_size = size;
+    device->ring->slotCount = depth;
+    device->ring->slotSize = sizeof(report_ring_slot);
+    device->ring->slotOffset = PAGE_SIZE;
+    device->queue = (report_ring_slot*)((unsigned char*)device->ring + PAGE_SIZE);
+    device->queue_mask = depth - 1;
+    device->queue_head = 0;
+    device->queue_overflow = 0;
+    return depth;
+}
+
+// called with device->lock held; returns true when the ring was empty before
+static bool report_queue_push(device_context* device, unsigned char const* data, unsigned int length, ktime_t time)
+{
+    report_ring_slot* slot;
+    unsigned int tail;
+
+    device->report_sequence++;
+    tail = report_queue_tail(device);
+    if (device->queue_head - tail > device->queue_mask)
+    {
+        device->queue_overflow++;
+        WRITE_ONCE(device->ring->overflow, device->queue_overflow);
+        if (device->ring_mapped)
+        {
+            // tail belongs to the mapping reader, so the new report is the one to go
+            return false;
+        }
+        WRITE_ONCE(device->ring->tail, tail + 1);
+    }
+    slot = &device->queue[device->queue_head & device->queue_mask];
+    memcpy(slot->data, data, length);
+    slot->header.length = length;
+    slot->header.sequence = device->report_sequence;
+    slot->header.timestamp = ktime_to_ns(time);
+    WRITE_ONCE(device->queue_head, device->queue_head + 1);
+    smp_store_release(&device->ring->head, device->queue_head);
+    return device->queue_head - 1 == tail;
+}
+
+// Queues a report for the readers, from the interrupt endpoint or a replay.
+static void receive_report(device_context* device, unsigned char const* data, unsigned int length, ktime_t now)
+{
+    unsigned long flags;
+    bool was_empty;
+
+    spin_lock_irqsave(&device->lock, flags);
+    atomic_long_inc(&device->statistics.reports_received);
+    if (device->statistics.last_report_time != 0)
+    {
+        histogram_add(device->statistics.report_interval, ktime_us_delta(now, device->statistics.last_report_time));
+    }
+    device->statistics.last_report_time = now;
+    if (device->statistics.resume_time != 0)
+    {
+        histogram_add(device->statistics.resume_to_report, ktime_us_delta(now, device->statistics.resume_time));
+        device->statistics.resume_time = 0;
+    }
+    was_empty = report_queue_push(device, data, length, now);
+    spin_unlock_irqrestore(&device->lock, flags);
+
+    // a reader only sleeps on an empty ring, so later reports need no wakeup
+    if (was_empty)
+    {
+        wake_up_interruptible(&device->queue_wait);
+    }
+    if (wq_has_sleeper(&device->listener_wait))
+    {
+        wake_up_interruptible(&device->listener_wait);
+    }
+}
+
+// decided like report_queue_pop() does, so a waiter never sees a report pop cannot return
+static bool report_queue_ready(device_context* device)
+{
+    return report_queue_tail(device) != READ_ONCE(device->queue_head);
+}
+
+// called with device->lock held; returns the report length, 0 when the ring is empty
+static unsigned int report_queue_pop(device_context* device, report_ring_slot* report)
+{
+    report_ring_slot* slot;
+    unsigned int length;
+    unsigned int tail;
+
+    tail = report_queue_tail(device);
+    if (device->queue_head == tail)
+    {
+        return 0;
+    }
+    if (latest_report_only)
+    {
+        device->queue_overflow += device->queue_head - tail - 1;
+        WRITE_ONCE(device->ring->overflow, device->queue_overflow);
+        tail = device->queue_head - 1;
+    }
+    // the slot may be mapped writable, so never trust its length
+    slot = &device->queue[tail & device->queue_mask];
+    length = min_t(unsigned int, slot->header.length, TOUCH_REPORT_SIZE);
+    report->header = slot->header;
+    report->header.length = length;
+    memcpy(report->data, slot->data, length);
+    smp_store_release(&device->ring->tail, tail + 1);
+    return length;
+}
+
+// called with device->lock held; like report_queue_pop() for a listener
+static unsigned int listener_pop(device_context* device, file_context* file, report_ring_slot* report)
+{
+    report_ring_slot* slot;
+    unsigned int length;
+    unsigned int lost;
+
+    if (file->cursor == device->queue_head)
+    {
+        return 0;
+    }
+    // only the newest slotCount reports are still in the ring
+    if (device->queue_head - file->cursor > device->queue_mask + 1)
+    {
+        lost = device->queue_head - file->cursor - (device->queue_mask + 1);
+        file->overflow += lost;
+        atomic_long_add(lost, &device->statistics.listener_overflow);
+        file->cursor = device->queue_head - (device->queue_mask + 1);
+    }
+    slot = &device->queue[file->cursor & device->queue_mask];
+    length = min_t(unsigned int, slot->header.length, TOUCH_REPORT_SIZE);
+    report->header = slot->header;
+    report->header.length = length;
+    memcpy(report->data, slot->data, length);
+    file->cursor++;
+    return length;
+}
+
+static bool file_ready(file_context* file)
+{
+    if (file->primary)
+    {
+        return report_queue_ready(file->device);
+    }
+    return READ_ONCE(file->device->queue_head) != READ_ONCE(file->cursor);
+}
+
+static wait_queue_head_t* file_wait(file_context* file)
+{
+    return file->primary ? &file->device->queue_wait : &file->device->listener_wait;
+}
+
+static ssize_t touch_read(struct file * filp, char * buffer, size_t count, loff_t * ppos)
+{
+    report_ring_slot report;
+    unsigned int length;
+    device_context * device;
+    file_context* file;
+    int r;
+
+    file = filp->private_data;
+    if (file == NULL)
+    {
+        return -EFAULT;
+    }
+    device = file->device;
+    if (file->read_format == TOUCH_READ_FORMAT_TIMESTAMPED && count < sizeof(report.header))
+    {
+        return -EINVAL;
+    }
+
+    for (;;)
+    {
+        spin_lock_irq(&device->lock);
+        if (file->primary)
+        {
+            length = report_queue_pop(device, &report);
+        }
+        else
+        {
+            length = listener_pop(device, file, &report);
+        }
+        spin_unlock_irq(&device->lock);
+        if (length != 0)
+        {
+            atomic_long_inc(&device->statistics.reads);
+            if (TOUCH_TRACE(report_dequeue_enabled)())
+            {
+                TOUCH_TRACE(report_dequeue)(device->usb_device, report.header.sequence, report_queue_count(device));
+            }
+            break;
+        }
+        if (device->disconnected)
+        {
+            return -ENODEV;
+        }
+        if (nonblocking_read)
+        {
+            return 0;
+        }
+        if ((filp->f_flags & O_NONBLOCK) != 0)
+        {
+            return -EAGAIN;
+        }
+        r = wait_event_interruptible(*file_wait(file), file_ready(file) || device->disconnected);
+        if (r != 0)
+        {
+            return r;
+        }
+    }
+    if (file->read_format == TOUCH_READ_FORMAT_TIMESTAMPED)
+    {
+        // header and data are adjacent in the slot
+        count = min_t(size_t, count, sizeof(report.header) + length);
+        if (copy_to_user(buffer, &report, count) != 0)
+        {
+            return -EFAULT;
+        }
+        return count;
+    }
+    if (count > length)
+    {
+        count = length;
+    }
+    if (copy_to_user(buffer, report.data, count) != 0)
+    {
+        return -EFAULT;
+    }
+    return count;
+}
+
+static int touch_mmap(struct file * filp, struct vm_area_struct * vma)
+{
+    device_context *device;
+    file_context* file;
+    int r;
+
+    file = filp->private_data;
+    if (file == NULL)
+    {
+        return -EFAULT;
+    }
+    // a mapping reader moves the tail, which belongs to the primary
+    if (!file->primary)
+    {
+        return -EPERM;
+    }
+    device = file->device;
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > device->ring_size)
+    {
+        return -EINVAL;
+    }
+    r = remap_vmalloc_range(vma, device->ring, 0);
+    if (r != 0)
+    {
+        return r;
+    }
+    // the mapping holds the file, so this stays set until touch_release()
+    device->ring_mapped = true;
+    return 0;
+}
+
+static ssize_t touch_write(struct file * filp, const char * user_buffer, size_t count, loff_t * ppos)
+{
+    if (filp->private_data == NULL)
+    {
+        return -EFAULT;
+    }
+
+    return -EFAULT;
+}
+
+// Blocking transfer, called with control_mutex held.
+static int control_transfer(device_context* device, bool in, void* buffer, unsigned short length)
+{
+    int r;
+
+    r = usb_autopm_get_interface(device->interface);
+    if (r != 0)
+    {
+        return r;
+    }
+    if (in)
+    {
+        r = usb_control_msg(device->usb_device, usb_rcvctrlpipe(device->usb_device, 0), 0, 0xc0, 0, 0, buffer, length, TOUCH_CONTROL_TIMEOUT_MS);
+    }
+    else
+    {
+        r = usb_control_msg(device->usb_device, usb_sndctrlpipe(device->usb_device, 0), 0, 0x40, 0, 0, buffer, length, TOUCH_CONTROL_TIMEOUT_MS);
+    }
+    usb_autopm_put_interface(device->interface);
+    return r;
+}
+
+static void on_control(struct urb* urb)
+{
+    device_context* device;
+    int status;
+
+    device = urb->context;
+    status = urb->status;
+    if (status == 0)
+    {
+        status = urb->actual_length;
+    }
+    else if (status == -ENOENT && READ_ONCE(device->control_timed_out))
+    {
+        status = -ETIMEDOUT;
+    }
+    device->control_status = status;
+    smp_store_release(&device->control_done, true);
+    // the primary polls queue_wait for EPOLLPRI
+    wake_up_interruptible(&device->queue_wait);
+    usb_autopm_put_interface_async(device->interface);
+}
+
+// usb_control_msg() has a timeout, an URB has none
+static void control_timeout_work(struct work_struct* work)
+{
+    device_context* device;
+
+    device = container_of(to_delayed_work(work), device_context, control_timeout_work);
+    WRITE_ONCE(device->control_timed_out, true);
+    usb_kill_urb(device->control_urb);
+}
+
+// Queues an asynchronous transfer through control_urb, called with control_mutex held.
+static long submit_control(device_context* device, bool in, unsigned short length, void const* data)
+{
+    int r;
+
+    if (length > TOUCH_CONTROL_BUFFER_SIZE)
+    {
+        return -EINVAL;
+    }
+    if (!in && copy_from_user(device->control_buffer, data, length) != 0)
+    {
+        return -EFAULT;
+    }
+    r = usb_autopm_get_interface(device->interface);
+    if (r != 0)
+    {
+        return r;
+    }
+    device->control_setup->bRequestType = in ? 0xc0 : 0x40;
+    device->control_setup->bRequest = 0;
+    device->control_setup->wValue = 0;
+    device->control_setup->wIndex = 0;
+    device->control_setup->wLength = cpu_to_le16(length);
+    usb_fill_control_urb(device->control_urb, device->usb_device,
+        in ? usb_rcvctrlpipe(device->usb_device, 0) : usb_sndctrlpipe(device->usb_device, 0),
+        (unsigned char*)device->control_setup, device->control_buffer, length, on_control, device);
+    device->control_in = in;
+    device->control_done = false;
+    device->control_timed_out = false;
+    device->control_submitted = true;
+    r = usb_submit_urb(device->control_urb, GFP_KERNEL);
+    if (r != 0)
+    {
+        device->control_submitted = false;
+        usb_autopm_put_interface(device->interface);
+        return r;
+    }
+    schedule_delayed_work(&device->control_timeout_work, msecs_to_jiffies(TOUCH_CONTROL_TIMEOUT_MS));
+    return 0;
+}
+
+// Drops an asynchronous transfer nobody is going to collect, called with control_mutex held.
+static void cancel_control(device_context* device)
+{
+    cancel_delayed_work_sync(&device->control_timeout_work);
+    usb_kill_urb(device->control_urb);
+    device->control_submitted = false;
+    device->control_done = false;
+    device->control_key_length = 0;
+}
+
+static control_cache_entry* control_cache_find(device_context* device, unsigned short length)
+{
+    control_cache_entry* entry;
+    unsigned int i;
+
+    for (i = 0; i < TOUCH_CONTROL_CACHE_ENTRIES; i++)
+    {
+        entry = &device->control_cache[i];
+        if (entry->data == NULL || entry->key_length != device->control_key_length)
+        {
+            continue;
+        }
+        // a zero length matches any entry of the key
+        if ((length == 0 || entry->length == length) && memcmp(entry->key, device->control_key, entry->key_length) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void control_cache_store(device_context* device, unsigned short length, void const* data, unsigned int data_length)
+{
+    control_cache_entry* entry;
+
+    entry = &device->control_cache[device->control_cache_next++ % TOUCH_CONTROL_CACHE_ENTRIES];
+    kfree(entry->data);
+    // a failed allocation just leaves the entry empty
+    entry->data = kmemdup(data, max(data_length, 1u), GFP_KERNEL);
+    entry->key_length = device->control_key_length;
+    entry->length = length;
+    entry->data_length = data_length;
+    memcpy(entry->key, device->control_key, device->control_key_length);
+}
+
+static long set_report(device_context *device, unsigned int flags, unsigned short length, void const* data)
+{
+    void* kernel_data;
+    long r;
+
+    if (length < 1)
+    {
+        return -EFAULT;
+    }
+    if (device->control_submitted)
+    {
+        return -EBUSY;
+    }
+    device->control_key_length = 0;
+    if ((flags & TOUCH_IOCTL_CODE(FLAG_ASYNC)) != 0)
+    {
+        return submit_control(device, false, length, data);
+    }
+
+    kernel_data = device->control_buffer;
+    if (length > TOUCH_CONTROL_BUFFER_SIZE)
+    {
+        kernel_data = kmalloc(length, GFP_KERNEL);
+        if (kernel_data == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+    do
+    {
+        if (copy_from_user(kernel_data, data, length) != 0)
+        {
+            r = -EFAULT;
+            break;
+        }
+        if ((flags & TOUCH_IOCTL_CODE(FLAG_CACHED)) != 0 && length <= TOUCH_CONTROL_CACHE_KEY_SIZE)
+        {
+            memcpy(device->control_key, kernel_data, length);
+            device->control_key_length = length;
+            // the block was read before, the GET_REPORT will not need the device either
+            if (control_cache_find(device, 0) != NULL)
+            {
+                device->control_key_sent = false;
+                atomic_long_inc(&device->statistics.control_cache_hits);
+                r = length;
+                break;
+            }
+            device->control_key_sent = true;
+        }
+        r = control_transfer(device, false, kernel_data, length);
+    } while (false);
+    if (kernel_data != device->control_buffer)
+    {
+        kfree(kernel_data);
+    }
+    return r;
+}
+static long get_report(device_context *device, unsigned int flags, unsigned short length, void* data)
+{
+    control_cache_entry* entry;
+    bool cached;
+    void* kernel_data;
+    long r;
+
+    if (length < 1)
+    {
+        return -EFAULT;
+    }
+    if (device->control_submitted)
+    {
+        return -EBUSY;
+    }
+    cached = (flags & (TOUCH_IOCTL_CODE(FLAG_CACHED) | TOUCH_IOCTL_CODE(FLAG_ASYNC))) == TOUCH_IOCTL_CODE(FLAG_CACHED) && device->control_key_length != 0;
+    if (cached)
+    {
+        entry = control_cache_find(device, length);
+        if (entry != NULL)
+        {
+            atomic_long_inc(&device->statistics.control_cache_hits);
+            if (copy_to_user(data, entry->data, entry->data_length) != 0)
+            {
+                return -EFAULT;
+            }
+            return entry->data_length;
+        }
+    }
+    // the device answers for the block it saw selected last, so a SET_REPORT
+    // answered from the cache goes out before any read that does reach it;
+    // only the synchronous path can send it without blocking in an async call
+    if (device->control_key_length != 0 && !device->control_key_sent)
+    {
+        if ((flags & TOUCH_IOCTL_CODE(FLAG_ASYNC)) != 0)
+        {
+            return -EBUSY;
+        }
+        r = control_transfer(device, false, device->control_key, device->control_key_length);
+        if (r < 0)
+        {
+            return r;
+        }
+        device->control_key_sent = true;
+    }
+    if ((flags & TOUCH_IOCTL_CODE(FLAG_ASYNC)) != 0)
+    {
+        device->control_key_length = 0;
+        return submit_control(device, true, length, NULL);
+    }
+
+    kernel_data = device->control_buffer;
+    if (length > TOUCH_CONTROL_BUFFER_SIZE)
+    {
+        kernel_data = kmalloc(length, GFP_KERNEL);
+        if (kernel_data == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+    r = control_transfer(device, true, kernel_data, length);
+    if (r >= 0)
+    {
+        if (cached)
+        {
+            control_cache_store(device, length, kernel_data, r);
+        }
+        if (copy_to_user(data, kernel_data, r) != 0)
+        {
+            r = -EFAULT;
+        }
+    }
+    if (kernel_data != device->control_buffer)
+    {
+        kfree(kernel_data);
+    }
+    return r;
+}
+static long get_control_result(device_context* device, unsigned short length, void* data)
+{
+    long r;
+
+    if (!device->control_submitted)
+    {
+        return -ENODATA;
+    }
+    if (!smp_load_acquire(&device->control_done))
+    {
+        return -EAGAIN;
+    }
+    cancel_delayed_work_sync(&device->control_timeout_work);
+    device->control_submitted = false;
+    WRITE_ONCE(device->control_done, false);
+    r = device->control_status;
+    if (r > 0 && device->control_in)
+    {
+        r = min_t(long, r, length);
+        if (copy_to_user(data, device->control_buffer, r) != 0)
+        {
+            return -EFAULT;
+        }
+    }
+    return r;
+}
+static long set_read_format(file_context* file, unsigned short format)
+{
+    if (format != TOUCH_READ_FORMAT_RAW && format != TOUCH_READ_FORMAT_TIMESTAMPED)
+    {
+        return -EINVAL;
+    }
+    file->read_format = format;
+    return 0;
+}
+static long claim_primary(file_context* file)
+{
+    device_context* device;
+    long r;
+
+    device = file->device;
+    r = 0;
+    mutex_lock(&device->io_mutex);
+    if (device->primary == NULL)
+    {
+        device->primary = file;
+        file->primary = true;
+    }
+    else if (!file->primary)
+    {
+        r = -EBUSY;
+    }
+    mutex_unlock(&device->io_mutex);
+    return r;
+}
+static long get_overflow(file_context* file)
+{
+    if (file->primary)
+    {
+        return READ_ONCE(file->device->queue_overflow);
+    }
+    return READ_ONCE(file->overflow);
+}
+// capture time of the report the reader consumed last
+static ktime_t last_capture_time(device_context *device)
+{
+    report_ring_slot const* slot;
+    ktime_t now;
+    ktime_t t;
+
+    now = ktime_get();
+    slot = &device->queue[(READ_ONCE(device->ring->tail) - 1) & device->queue_mask];
+    t = ns_to_ktime(READ_ONCE(slot->header.timestamp));
+    // the slot may be mapped writable or not filled yet
+    if (ktime_after(t, now) || ktime_before(t, ktime_sub_ns(now, NSEC_PER_SEC)))
+    {
+        return now;
+    }
+    return t;
+}
+// Stamps the next input frame. Consecutive frames are spaced by their scanTime
+// delta, which follows the camera scan clock rather than USB and daemon jitter,
+// but the result never runs ahead of the capture time or lags far behind it.
+static void set_frame_timestamp(device_context *device, unsigned short scan_time)
+{
+    ktime_t capture;
+    ktime_t t;
+
+    capture = last_capture_time(device);
+    t = capture;
+    if (scan_time_unit_us != 0 && device->frame_time != 0)
+    {
+        t = ktime_add_us(device->frame_time, (unsigned short)(scan_time - device->frame_scan_time) * scan_time_unit_us);
+        if (ktime_after(t, capture) || ktime_before(t, ktime_sub_ns(capture, TOUCH_FRAME_TIME_WINDOW_NS)))
+        {
+            t = capture;
+        }
+    }
+    device->frame_time = t;
+    device->frame_scan_time = scan_time;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0))
+    input_set_timestamp(device->input_dev, t);
+#endif
+}
+static void calibration_identity(calibration_matrix* matrix)
+{
+    memset(matrix->m, 0, sizeof(matrix->m));
+    matrix->m[0] = TOUCH_CALIBRATION_ONE;
+    matrix->m[4] = TOUCH_CALIBRATION_ONE;
+    matrix->m[8] = TOUCH_CALIBRATION_ONE;
+    matrix->identity = true;
+}
+static void calibration_get(device_context *device, calibration_matrix* matrix)
+{
+    unsigned int sequence;
+
+    do
+    {
+        sequence = read_seqbegin(&device->calibration_lock);
+        *matrix = device->calibration;
+    } while (read_seqretry(&device->calibration_lock, sequence));
+}
+// The per frame part of the contact path, taken once before the slots are reported.
+typedef struct _frame_context
+{
+    calibration_matrix matrix;
+    filter_params filter;
+    unsigned int interval_us;
+    unsigned int predict_horizon_us;
+    ktime_t time;
+}
+frame_context;
+
+// called after set_frame_timestamp()
+static void frame_begin(device_context *device, frame_context* frame)
+{
+    calibration_get(device, &frame->matrix);
+    frame->filter.min_cutoff_mhz = READ_ONCE(device->filter.min_cutoff_mhz);
+    frame->filter.beta = READ_ONCE(device->filter.beta);
+    frame->filter.d_cutoff_mhz = READ_ONCE(device->filter.d_cutoff_mhz);
+    frame->interval_us = clamp_t(s64, ktime_us_delta(device->frame_time, device->filter_time), 1, TOUCH_FILTER_INTERVAL_MAX_US);
+    frame->predict_horizon_us = READ_ONCE(device->predict_horizon_us);
+    frame->time = device->frame_time;
+    device->filter_time = device->frame_time;
+}
+// Smoothing factor of a low-pass filter with the given cutoff over one interval.
+static u32 filter_alpha(u64 cutoff_mhz, unsigned int interval_us)
+{
+    u64 tau_us;
+
+    // tau = 1 / (2 pi cutoff), 159154943 = 10^9 / (2 pi)
+    tau_us = div64_u64(159154943ull, max_t(u64, cutoff_mhz, 1));
+    return div64_u64((u64)interval_us << TOUCH_FILTER_ALPHA_SHIFT, interval_us + tau_us);
+}
+// One axis of the 1 euro filter (Casiez et al.): the cutoff rises with the
+// filtered speed, so a resting contact is smoothed hard and a moving one
+// follows with little lag. beta is in mHz per device unit per second.
+static int filter_axis_update(filter_axis* axis, int value, bool reset, frame_context const* frame)
+{
+    s32 target;
+    s64 speed;
+    u64 cutoff;
+    u32 alpha;
+
+    target = value * (1 << TOUCH_FILTER_VALUE_SHIFT);
+    if (reset)
+    {
+        axis->value = target;
+        axis->speed = 0;
+        return value;
+    }
+    speed = div_s64((s64)(target - axis->value) * USEC_PER_SEC, frame->interval_us << TOUCH_FILTER_VALUE_SHIFT);
+    speed = clamp_t(s64, speed, -TOUCH_FILTER_SPEED_MAX, TOUCH_FILTER_SPEED_MAX);
+    alpha = filter_alpha(frame->filter.d_cutoff_mhz, frame->interval_us);
+    axis->speed += ((speed - axis->speed) * alpha) >> TOUCH_FILTER_ALPHA_SHIFT;
+    cutoff = frame->filter.min_cutoff_mhz + (u64)frame->filter.beta * abs(axis->speed);
+    alpha = filter_alpha(cutoff, frame->interval_us);
+    axis->value += ((s64)(target - axis->value) * alpha) >> TOUCH_FILTER_ALPHA_SHIFT;
+    return (axis->value + (1 << (TOUCH_FILTER_VALUE_SHIFT - 1))) >> TOUCH_FILTER_VALUE_SHIFT;
+}
+// Scores a pending prediction once the stroke has passed its target time,
+// against the position interpolated between the last two frames.
+static void predict_score(device_context *device, predict_slot* state, s32 x, s32 y, ktime_t time)
+{
+    s64 span;
+    s64 part;
+    s64 dx;
+    s64 dy;
+
+    if (!state->pending || ktime_before(time, state->target))
+    {
+        return;
+    }
+    state->pending = false;
+    span = ktime_us_delta(time, state->time[state->newest]);
+    part = ktime_us_delta(state->target, state->time[state->newest]);
+    if (span <= 0 || part < 0)
+    {
+        return;
+    }
+    dx = state->x[state->newest] + div_s64((x - state->x[state->newest]) * part, span) - state->predicted_x;
+    dy = state->y[state->newest] + div_s64((y - state->y[state->newest]) * part, span) - state->predicted_y;
+    histogram_add(device->statistics.prediction_error, int_sqrt(dx * dx + dy * dy));
+}
+// Extrapolates the contact of slot by the horizon, from its velocity over the
+// last frames as spaced by their scanTime. A new stroke is left alone until it
+// has TOUCH_PREDICT_FRAMES_MIN frames, and so is a slowing one, which is most
+// likely about to end and would overshoot.
+static void predict_contact(device_context *device, frame_context const* frame, unsigned int slot, bool reset, int* x, int* y)
+{
+    predict_slot* state;
+    unsigned int oldest;
+    s64 window_us;
+    s64 last_us;
+    s64 window_speed;
+    s64 last_speed;
+    s32 dx;
+    s32 dy;
+
+    state = &device->predict[slot];
+    if (reset)
+    {
+        state->count = 0;
+        state->pending = false;
+    }
+    if (state->count != 0)
+    {
+        predict_score(device, state, *x, *y, frame->time);
+        // several frames can share a capture time, the newest position wins
+        if (ktime_compare(frame->time, state->time[state->newest]) > 0)
+        {
+            state->newest = (state->newest + 1) % TOUCH_PREDICT_HISTORY;
+            state->count = min_t(unsigned int, state->count + 1, TOUCH_PREDICT_HISTORY);
+        }
+    }
+    else
+    {
+        state->count = 1;
+    }
+    state->x[state->newest] = *x;
+    state->y[state->newest] = *y;
+    state->time[state->newest] = frame->time;
+    if (frame->predict_horizon_us == 0 || state->count < TOUCH_PREDICT_FRAMES_MIN)
+    {
+        return;
+    }
+
+    oldest = (state->newest + TOUCH_PREDICT_HISTORY - state->count + 1) % TOUCH_PREDICT_HISTORY;
+    window_us = ktime_us_delta(frame->time, state->time[oldest]);
+    last_us = ktime_us_delta(frame->time, state->time[(state->newest + TOUCH_PREDICT_HISTORY - 1) % TOUCH_PREDICT_HISTORY]);
+    if (window_us <= 0 || last_us <= 0)
+    {
+        return;
+    }
+    dx = *x - state->x[oldest];
+    dy = *y - state->y[oldest];
+    // speeds compared as max(|dx|, |dy|) per interval, cross-multiplied
+    window_speed = (s64)max(abs(dx), abs(dy)) * last_us;
+    last_speed = (s64)max(abs(*x - state->x[(state->newest + TOUCH_PREDICT_HISTORY - 1) % TOUCH_PREDICT_HISTORY]),
+        abs(*y - state->y[(state->newest + TOUCH_PREDICT_HISTORY - 1) % TOUCH_PREDICT_HISTORY])) * window_us;
+    if (window_speed == 0 || 2 * last_speed < window_speed)
+    {
+        return;
+    }
+    *x += div_s64((s64)dx * frame->predict_horizon_us, window_us);
+    *y += div_s64((s64)dy * frame->predict_horizon_us, window_us);
+    state->predicted_x = *x;
+    state->predicted_y = *y;
+    state->target = ktime_add_us(frame->time, frame->predict_horizon_us);
+    state->pending = true;
+    atomic_long_inc(&device->statistics.predictions);
+}
+static int calibration_axis(s64 value)
+{
+    return clamp_t(s64, value >> TOUCH_CALIBRATION_SHIFT, 0, TOUCH_AXIS_MAX);
+}
+// Reports the contact of the current slot, which is slot, through the jitter
+// filter, the predictor and the frame's matrix. A slot not touching before
+// starts a new stroke. The size follows the linear part of the matrix without
+// its sign, so a rotation by 90 degrees swaps width and height.
+static void report_contact(device_context *device, frame_context const* frame, unsigned int slot, int x, int y, int width, int height)
+{
+    s32 const* m;
+    bool filter_reset;
+    bool reset;
+
+    reset = (device->active_slots & (1u << slot)) == 0;
+    if (frame->filter.min_cutoff_mhz != 0)
+    {
+        // a filter switched on mid-stroke starts from the current position as well
+        filter_reset = reset || (device->filtered_slots & (1u << slot)) == 0;
+        x = filter_axis_update(&device->filter_state[slot][0], x, filter_reset, frame);
+        y = filter_axis_update(&device->filter_state[slot][1], y, filter_reset, frame);
+        device->filtered_slots |= 1u << slot;
+    }
+    else
+    {
+        device->filtered_slots &= ~(1u << slot);
+    }
+    predict_contact(device, frame, slot, reset, &x, &y);
+    m = frame->matrix.m;
+    if (!frame->matrix.identity)
+    {
+        input_report_abs(device->input_dev, ABS_MT_TOUCH_MAJOR, calibration_axis((s64)abs(m[0]) * width + (s64)abs(m[1]) * height));
+        input_report_abs(device->input_dev, ABS_MT_TOUCH_MINOR, calibration_axis((s64)abs(m[3]) * width + (s64)abs(m[4]) * height));
+        input_report_abs(device->input_dev, ABS_MT_POSITION_X, calibration_axis((s64)m[0] * x + (s64)m[1] * y + m[2]));
+        input_report_abs(device->input_dev, ABS_MT_POSITION_Y, calibration_axis((s64)m[3] * x + (s64)m[4] * y + m[5]));
+        return;
+    }
+    input_report_abs(device->input_dev, ABS_MT_TOUCH_MAJOR, clamp(width, 0, TOUCH_AXIS_MAX));
+    input_report_abs(device->input_dev, ABS_MT_TOUCH_MINOR, clamp(height, 0, TOUCH_AXIS_MAX));
+    input_report_abs(device->input_dev, ABS_MT_POSITION_X, clamp(x, 0, TOUCH_AXIS_MAX));
+    input_report_abs(device->input_dev, ABS_MT_POSITION_Y, clamp(y, 0, TOUCH_AXIS_MAX));
+}
+static void sync_frame(device_context *device, unsigned int contacts)
+{
+    input_sync(device->input_dev);
+    histogram_add(device->statistics.report_to_sync, ktime_us_delta(ktime_get(), last_capture_time(device)));
+    if (TOUCH_TRACE(input_sync_enabled)())
+    {
+        TOUCH_TRACE(input_sync)(device->usb_device, consumed_sequence(device), report_queue_count(device), contacts);
+    }
+}
+static long sync_absolute_mouse(device_context *device, unsigned short length, void const* data)
+{
+    // TODO
+    return 0;
+}
+static long sync_singletouch(device_context *device, unsigned short length, void const* data)
+{
+    report_packet_single_touch value;
+    frame_context frame;
+    int r;
+
+    if (length < sizeof(value))
+    {
+        return 0;
+    }
+    r = copy_from_user(&value, data, sizeof(value));
+    if (r != 0)
+    {
+        return 0;
+    }
+    if ((value.touchPoint.state & TOUCH_POINT_IS_VALID) == 0)
+    {
+        return sizeof(value);
+    }
+    set_frame_timestamp(device, value.scanTime);
+    input_mt_slot(device->input_dev, 0);
+    if ((value.touchPoint.state & TOUCH_POINT_IS_TOUCHED) != 0)
+    {
+        input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, true);
+        frame_begin(device, &frame);
+        report_contact(device, &frame, 0, value.touchPoint.x, value.touchPoint.y, value.touchPoint.width, value.touchPoint.height);
+        device->active_slots |= 1u;
+    }
+    else
+    {
+        input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, false);
+        device->active_slots &= ~1u;
+    }
+    sync_frame(device, (value.touchPoint.state & TOUCH_POINT_IS_TOUCHED) != 0);
+    return sizeof(value);
+}
+static void report_multitouch(device_context *device, report_packet_multi_touch const* packet)
+{
+    frame_context frame;
+    unsigned int contacts;
+    unsigned int active;
+    int i;
+
+    contacts = 0;
+    active = 0;
+    set_frame_timestamp(device, packet->scanTime);
+    frame_begin(device, &frame);
+    TOUCH_POINT_LOOP
+    for (i = 0; i < TOUCH_POINT_COUNT; i++)
+    {
+        /* Ensure we always select the slot so we can report releases even when
+         * the incoming report marks the slot as invalid (IsValid == 0).
+         * Some upstream code may mark a point invalid instead of explicitly
+         * sending an "Up" event; treating invalid as release prevents stuck
+         * touches in the input layer. */
+        input_mt_slot(device->input_dev, i);
+        if ((packet->touchPoint[i].state & TOUCH_POINT_IS_VALID) == 0)
+        {
+            /* Report slot as released */
+            input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, false);
+            continue;
+        }
+
+        if ((packet->touchPoint[i].state & TOUCH_POINT_IS_TOUCHED) != 0)
+        {
+            input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, true);
+            report_contact(device, &frame, i, packet->touchPoint[i].x, packet->touchPoint[i].y, packet->touchPoint[i].width, packet->touchPoint[i].height);
+            active |= 1u << i;
+            contacts++;
+        }
+        else
+        {
+            input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, false);
+        }
+    }
+    device->active_slots = active;
+    sync_frame(device, contacts);
+}
+static long sync_multitouch(device_context *device, unsigned short length, void const* data)
+{
+    report_packet_multi_touch value;
+    int r;
+
+    if (length < sizeof(value))
+    {
+        return 0;
+    }
+    r = copy_from_user(&value, data, sizeof(value));
+    if (r != 0)
+    {
+        return 0;
+    }
+    report_multitouch(device, &value);
+    return sizeof(value);
+}
+static bool is_touching(report_touch_point const* point)
+{
+    return (point->state & (TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED)) == (TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED);
+}
+// Emits the lifts hidden in frames[0..count-2] for slots that touch again in
+// frames[count-1], so collapsing a batch never merges two strokes into one.
+static void report_skipped_lifts(device_context *device, report_packet_multi_touch const* frames, unsigned int count)
+{
+    report_packet_multi_touch const* newest;
+    unsigned int lifted;
+    unsigned int frame;
+    int i;
+
+    newest = &frames[count - 1];
+    lifted = 0;
+    for (frame = 0; frame + 1 < count; frame++)
+    {
+        TOUCH_POINT_LOOP
+        for (i = 0; i < TOUCH_POINT_COUNT; i++)
+        {
+            if (!is_touching(&frames[frame].touchPoint[i]) && is_touching(&newest->touchPoint[i]))
+            {
+                lifted |= 1u << i;
+            }
+        }
+    }
+    if (lifted == 0)
+    {
+        return;
+    }
+    TOUCH_POINT_LOOP
+    for (i = 0; i < TOUCH_POINT_COUNT; i++)
+    {
+        if ((lifted & (1u << i)) != 0)
+        {
+            input_mt_slot(device->input_dev, i);
+            input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, false);
+        }
+    }
+    device->active_slots &= ~lifted;
+    sync_frame(device, 0);
+}
+static long sync_multitouch_batch(device_context *device, unsigned int flags, unsigned short length, void const* data)
+{
+    report_packet_multi_touch const* frames;
+    unsigned int count;
+    unsigned int i;
+
+    count = length / sizeof(report_packet_multi_touch);
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (device->batch == NULL)
+    {
+        device->batch = kvmalloc(TOUCH_IOCTL_CODE(LENGTH_MASK), GFP_KERNEL);
+        if (device->batch == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+    if (copy_from_user(device->batch, data, count * sizeof(report_packet_multi_touch)) != 0)
+    {
+        return 0;
+    }
+    frames = device->batch;
+    if ((flags & TOUCH_IOCTL_CODE(FLAG_LATEST_ONLY)) != 0)
+    {
+        report_skipped_lifts(device, frames, count);
+        report_multitouch(device, &frames[count - 1]);
+    }
+    else
+    {
+        for (i = 0; i < count; i++)
+        {
+            report_multitouch(device, &frames[i]);
+        }
+    }
+    return count * sizeof(report_packet_multi_touch);
+}
+static long sync_multitouch_sparse(device_context *device, unsigned short length, void const* data)
+{
+    report_packet_sparse_multi_touch value;
+    report_sparse_touch_point const* point;
+    frame_context frame;
+    unsigned int released;
+    unsigned int pending;
+    unsigned int size;
+    unsigned int i;
+
+    size = offsetof(report_packet_sparse_multi_touch, touchPoint);
+    if (length < size)
+    {
+        return 0;
+    }
+    if (copy_from_user(&value, data, min_t(unsigned int, length, sizeof(value))) != 0)
+    {
+        return 0;
+    }
+    if (value.activeMask >= 1u << TOUCH_POINT_COUNT ||
+        (value.changedMask & ~value.activeMask) != 0 ||
+        (value.activeMask & ~device->active_slots & ~value.changedMask) != 0)
+    {
+        return 0;
+    }
+    size += hweight16(value.changedMask) * sizeof(value.touchPoint[0]);
+    if (length < size)
+    {
+        return 0;
+    }
+
+    set_frame_timestamp(device, value.scanTime);
+    frame_begin(device, &frame);
+    released = device->active_slots & ~value.activeMask;
+    point = value.touchPoint;
+    for (pending = released | value.changedMask; pending != 0; pending &= pending - 1)
+    {
+        i = __ffs(pending);
+        input_mt_slot(device->input_dev, i);
+        if ((released & (1u << i)) != 0)
+        {
+            input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, false);
+            continue;
+        }
+        input_mt_report_slot_state(device->input_dev, MT_TOOL_FINGER, true);
+        report_contact(device, &frame, i, point->x, point->y, point->width, point->height);
+        point++;
+    }
+    device->active_slots = value.activeMask;
+    sync_frame(device, hweight16(value.activeMask));
+    return size;
+}
+static long sync_keyboard(device_context *device, unsigned short length, void const* data)
+{
+    // TODO
+    return 0;
+}
+static unsigned long diagnostic_record_size(unsigned int length)
+{
+    return ALIGN(sizeof(diagnostic_header) + length, 8);
+}
+// The diagnostics copy helpers take a free running ring position and wrap at the end.
+static void diagnostics_read_ring(device_context *device, void* to, unsigned long position, size_t length)
+{
+    unsigned long offset;
+    size_t first;
+
+    offset = position & device->diagnostics_mask;
+    first = min_t(size_t, length, device->diagnostics_mask + 1 - offset);
+    memcpy(to, device->diagnostics + offset, first);
+    memcpy((unsigned char*)to + first, device->diagnostics, length - first);
+}
+static void diagnostics_write_ring(device_context *device, unsigned long position, void const* from, size_t length)
+{
+    unsigned long offset;
+    size_t first;
+
+    offset = position & device->diagnostics_mask;
+    first = min_t(size_t, length, device->diagnostics_mask + 1 - offset);
+    memcpy(device->diagnostics + offset, from, first);
+    memcpy(device->diagnostics, (unsigned char const*)from + first, length - first);
+}
+static int diagnostics_write_ring_user(device_context *device, unsigned long position, void const* from, size_t length)
+{
+    unsigned long offset;
+    size_t first;
+
+    offset = position & device->diagnostics_mask;
+    first = min_t(size_t, length, device->diagnostics_mask + 1 - offset);
+    if (copy_from_user(device->diagnostics + offset, from, first) != 0)
+    {
+        return -EFAULT;
+    }
+    if (copy_from_user(device->diagnostics, (unsigned char const*)from + first, length - first) != 0)
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+static int diagnostics_read_ring_user(device_context *device, void* to, unsigned long position, size_t length)
+{
+    unsigned long offset;
+    size_t first;
+
+    offset = position & device->diagnostics_mask;
+    first = min_t(size_t, length, device->diagnostics_mask + 1 - offset);
+    if (copy_to_user(to, device->diagnostics + offset, first) != 0)
+    {
+        return -EFAULT;
+    }
+    if (copy_to_user((unsigned char*)to + first, device->diagnostics, length - first) != 0)
+    {
+        return -EFAULT;
+    }
+    return 0;
+}
+// Appends one record, overwriting the oldest ones when the ring is full.
+// Called with diagnostics_mutex held.
+static long diagnostics_push(device_context *device, unsigned int type, unsigned short length, void const* data)
+{
+    diagnostic_header header;
+    unsigned long size;
+    unsigned long head;
+    unsigned long tail;
+
+    if (device->diagnostics == NULL)
+    {
+        size = roundup_pow_of_two(clamp_t(unsigned int, diagnostics_kb, TOUCH_DIAGNOSTICS_KB_MIN, TOUCH_DIAGNOSTICS_KB_MAX)) * 1024ul;
+        // zeroed, the padding of records never shows stale memory
+        device->diagnostics = vzalloc(size);
+        if (device->diagnostics == NULL)
+        {
+            return -ENOMEM;
+        }
+        device->diagnostics_mask = size - 1;
+    }
+
+    size = diagnostic_record_size(length);
+    head = device->diagnostics_head;
+    tail = device->diagnostics_tail;
+    while (head + size - tail > device->diagnostics_mask + 1)
+    {
+        diagnostics_read_ring(device, &header, tail, sizeof(header));
+        tail += diagnostic_record_size(header.length);
+        atomic_long_inc(&device->statistics.diagnostic_overwritten);
+    }
+    WRITE_ONCE(device->diagnostics_tail, tail);
+    // a reader still copying the dropped records sees the new tail afterwards
+    smp_wmb();
+
+    header.type = type;
+    header.length = length;
+    header.sequence = ++device->diagnostics_sequence;
+    header.reserved = 0;
+    header.timestamp = ktime_get_ns();
+    diagnostics_write_ring(device, head, &header, sizeof(header));
+    if (diagnostics_write_ring_user(device, head + sizeof(header), data, length) != 0)
+    {
+        // nothing is published, the next record takes the space
+        return 0;
+    }
+    smp_store_release(&device->diagnostics_head, head + size);
+    atomic_long_inc(&device->statistics.diagnostic_records);
+    if (wq_has_sleeper(&device->diagnostics_wait))
+    {
+        wake_up_interruptible(&device->diagnostics_wait);
+    }
+    return length;
+}
+static long sync_diagnosis(device_context *device, unsigned short length, void const* data)
+{
+    return diagnostics_push(device, TOUCH_IOCTL_CODE(TYPE_SYNC_DIAGNOSIS), length, data);
+}
+static long sync_rawtouch(device_context *device, unsigned short length, void const* data)
+{
+    return diagnostics_push(device, TOUCH_IOCTL_CODE(TYPE_SYNC_RAWTOUCH), length, data);
+}
+static long sync_touch(device_context *device, unsigned short length, void const* data)
+{
+    return diagnostics_push(device, TOUCH_IOCTL_CODE(TYPE_SYNC_TOUCH), length, data);
+}
+static long sync_virtualkey(device_context *device, unsigned short length, void const* data)
+{
+    // TODO
+    return 0;
+}
+static long dispatch_ioctl(device_context *device, unsigned int ctl_code, unsigned long ctl_param)
+{
+    switch (ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK))
+    {
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_ABSOLUTEMOUSE):
+        return sync_absolute_mouse(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_SINGLETOUCH):
+        return sync_singletouch(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH):
+        return sync_multitouch(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_KEYBOARD):
+        return sync_keyboard(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH_BATCH):
+        return sync_multitouch_batch(device, ctl_code & TOUCH_IOCTL_CODE(FLAG_MASK), ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH_SPARSE):
+        return sync_multitouch_sparse(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_VIRTUALKEY):
+        return sync_virtualkey(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+
+    }
+    return 0;
+}
+static long dispatch_diagnostics(device_context *device, unsigned int ctl_code, unsigned long ctl_param)
+{
+    switch (ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK))
+    {
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_DIAGNOSIS):
+        return sync_diagnosis(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_RAWTOUCH):
+        return sync_rawtouch(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_TOUCH):
+        return sync_touch(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    }
+    return 0;
+}
+static long dispatch_control(device_context *device, unsigned int ctl_code, unsigned long ctl_param)
+{
+    switch (ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK))
+    {
+    case TOUCH_IOCTL_CODE(TYPE_SET_REPORT):
+        return set_report(device, ctl_code & TOUCH_IOCTL_CODE(FLAG_MASK), ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void const*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_GET_REPORT):
+        return get_report(device, ctl_code & TOUCH_IOCTL_CODE(FLAG_MASK), ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void*)ctl_param);
+    case TOUCH_IOCTL_CODE(TYPE_GET_CONTROL_RESULT):
+        return get_control_result(device, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK), (void*)ctl_param);
+    }
+    return 0;
+}
+// Runs a control code under the lock it needs, see touch_unlocked_ioctl().
+static long dispatch_file_ioctl(file_context* file, unsigned int ctl_code, unsigned long ctl_param)
+{
+    device_context *device;
+    long r;
+
+    device = file->device;
+    // control codes that only concern the calling file
+    switch (ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK))
+    {
+    case TOUCH_IOCTL_CODE(TYPE_SET_READ_FORMAT):
+        return set_read_format(file, ctl_code & TOUCH_IOCTL_CODE(LENGTH_MASK));
+    case TOUCH_IOCTL_CODE(TYPE_GET_OVERFLOW):
+        return get_overflow(file);
+    case TOUCH_IOCTL_CODE(TYPE_CLAIM_PRIMARY):
+        return claim_primary(file);
+    }
+    if (!file->primary)
+    {
+        return -EPERM;
+    }
+
+    // control transfers take control_mutex instead, so they never hold up the SYNC_* codes
+    switch (ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK))
+    {
+    case TOUCH_IOCTL_CODE(TYPE_SET_REPORT):
+    case TOUCH_IOCTL_CODE(TYPE_GET_REPORT):
+    case TOUCH_IOCTL_CODE(TYPE_GET_CONTROL_RESULT):
+        mutex_lock(&device->control_mutex);
+        r = device->disconnected ? -ENODEV : dispatch_control(device, ctl_code, ctl_param);
+        mutex_unlock(&device->control_mutex);
+        return r;
+    // diagnostic records touch neither the device nor input_dev
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_DIAGNOSIS):
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_RAWTOUCH):
+    case TOUCH_IOCTL_CODE(TYPE_SYNC_TOUCH):
+        mutex_lock(&device->diagnostics_mutex);
+        r = dispatch_diagnostics(device, ctl_code, ctl_param);
+        mutex_unlock(&device->diagnostics_mutex);
+        return r;
+    }
+
+    // disconnect unregisters input_dev under io_mutex, so it stays valid here
+    mutex_lock(&device->io_mutex);
+    r = device->disconnected ? -ENODEV : dispatch_ioctl(device, ctl_code, ctl_param);
+    mutex_unlock(&device->io_mutex);
+    return r;
+}
+static long touch_unlocked_ioctl(struct file * filp, unsigned int ctl_code, unsigned long ctl_param)
+{
+    device_context *device;
+    file_context* file;
+    long r;
+
+    file = filp->private_data;
+    if (file == NULL)
+    {
+        return -EFAULT;
+    }
+    device = file->device;
+
+    atomic_long_inc(&device->statistics.ioctls[(ctl_code & TOUCH_IOCTL_CODE(TYPE_MASK)) >> 16]);
+    // the open file holds the device, usb_device and the ring stay valid after a disconnect
+    if (TOUCH_TRACE(ioctl_enter_enabled)())
+    {
+        TOUCH_TRACE(ioctl_enter)(device->usb_device, consumed_sequence(device), report_queue_count(device), ctl_code);
+    }
+    r = dispatch_file_ioctl(file, ctl_code, ctl_param);
+    if (TOUCH_TRACE(ioctl_exit_enabled)())
+    {
+        TOUCH_TRACE(ioctl_exit)(device->usb_device, consumed_sequence(device), report_queue_count(device), ctl_code, r);
+    }
+    return r;
+}
+
+static __poll_t touch_poll(struct file * filp, poll_table * wait)
+{
+    file_context* file;
+    __poll_t mask;
+
+    file = filp->private_data;
+    if (file == NULL)
+    {
+        return EPOLLERR | EPOLLHUP;
+    }
+
+    poll_wait(filp, file_wait(file), wait);
+    mask = 0;
+    if (file_ready(file))
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (file->primary && smp_load_acquire(&file->device->control_done))
+    {
+        mask |= EPOLLPRI;
+    }
+    if (file->device->disconnected)
+    {
+        mask |= EPOLLERR | EPOLLHUP;
+    }
+    return mask;
+}
+
+static int touch_open(struct inode * inode, struct file * filp)
+{
+    device_context* device;
+    struct usb_interface* interface;
+    file_context* file;
+    int subminor;
+
+    subminor = iminor(inode);
+
+    interface = usb_find_interface(&touch_driver, subminor);
+
+    if (interface == NULL)
+    {
+        err("%s: interface ptr is NULL.", __func__);
+        return -1;
+    }
+    device = usb_get_intfdata(interface);
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    file = kzalloc(sizeof(file_context), GFP_KERNEL);
+    if (file == NULL)
+    {
+        return -ENOMEM;
+    }
+    file->device = device;
+    file->read_format = TOUCH_READ_FORMAT_RAW;
+
+    // an open for writing claims the primary role, a read-only open is a
+    // listener until it sends CLAIM_PRIMARY
+    mutex_lock(&device->io_mutex);
+    if ((filp->f_mode & FMODE_WRITE) != 0)
+    {
+        if (device->primary != NULL)
+        {
+            mutex_unlock(&device->io_mutex);
+            kfree(file);
+            return -EBUSY;
+        }
+        device->primary = file;
+        file->primary = true;
+    }
+    else if (device->primary == NULL)
+    {
+        warn("%s: minor %d opened read-only with no primary, the ring is not consumed", __func__, subminor);
+    }
+    mutex_unlock(&device->io_mutex);
+    // a listener starts with the next report
+    spin_lock_irq(&device->lock);
+    file->cursor = device->queue_head;
+    spin_unlock_irq(&device->lock);
+
+    filp->private_data = file;
+    kref_get(&device->kref);
+
+    return 0;
+}
+
+static int touch_release(struct inode * inode, struct file * filp)
+{
+    device_context* device;
+    file_context* file;
+
+    file = filp->private_data;
+    if (file != NULL)
+    {
+        device = file->device;
+        // the next open for writing or CLAIM_PRIMARY becomes the primary
+        mutex_lock(&device->io_mutex);
+        if (file->primary)
+        {
+            device->primary = NULL;
+            device->ring_mapped = false;
+        }
+        mutex_unlock(&device->io_mutex);
+        if (file->primary)
+        {
+            mutex_lock(&device->control_mutex);
+            cancel_control(device);
+            mutex_unlock(&device->control_mutex);
+        }
+        kref_put(&device->kref, touch_delete);
+        kfree(file);
+    }
+    filp->private_data = NULL;
+
+    return 0;
+}
+
+// Reader of the diagnostics stream in debugfs, any number may be open.
+typedef struct _diagnostics_reader
+{
+    device_context* device;
+    unsigned long position;
+}
+diagnostics_reader;
+
+static bool diagnostics_ready(diagnostics_reader* reader)
+{
+    return smp_load_acquire(&reader->device->diagnostics_head) != reader->position || reader->device->disconnected;
+}
+
+// the record at position may have been overwritten once tail has passed it
+static bool diagnostics_overtaken(diagnostics_reader* reader)
+{
+    smp_rmb();
+    return (long)(READ_ONCE(reader->device->diagnostics_tail) - reader->position) > 0;
+}
+
+static int diagnostics_open(struct inode * inode, struct file * filp)
+{
+    diagnostics_reader* reader;
+    device_context* device;
+
+    device = inode->i_private;
+    reader = kzalloc(sizeof(diagnostics_reader), GFP_KERNEL);
+    if (reader == NULL)
+    {
+        return -ENOMEM;
+    }
+    reader->device = device;
+    // the whole buffered history comes first
+    reader->position = READ_ONCE(device->diagnostics_tail);
+    kref_get(&device->kref);
+    filp->private_data = reader;
+    return nonseekable_open(inode, filp);
+}
+
+static int diagnostics_release(struct inode * inode, struct file * filp)
+{
+    diagnostics_reader* reader;
+
+    reader = filp->private_data;
+    kref_put(&reader->device->kref, touch_delete);
+    kfree(reader);
+    return 0;
+}
+
+// Returns whole records only; a buffer too small for the next one fails with EINVAL.
+static ssize_t diagnostics_read(struct file * filp, char * buffer, size_t count, loff_t * ppos)
+{
+    diagnostics_reader* reader;
+    diagnostic_header header;
+    device_context* device;
+    unsigned long size;
+    size_t n;
+    int r;
+
+    reader = filp->private_data;
+    device = reader->device;
+    while (!diagnostics_ready(reader))
+    {
+        if ((filp->f_flags & O_NONBLOCK) != 0)
+        {
+            return -EAGAIN;
+        }
+        r = wait_event_interruptible(device->diagnostics_wait, diagnostics_ready(reader));
+        if (r != 0)
+        {
+            return r;
+        }
+    }
+
+    n = 0;
+    while (smp_load_acquire(&device->diagnostics_head) != reader->position)
+    {
+        if (diagnostics_overtaken(reader))
+        {
+            reader->position = READ_ONCE(device->diagnostics_tail);
+            continue;
+        }
+        diagnostics_read_ring(device, &header, reader->position, sizeof(header));
+        if (diagnostics_overtaken(reader))
+        {
+            continue;
+        }
+        size = diagnostic_record_size(header.length);
+        if (n + size > count)
+        {
+            if (n == 0)
+            {
+                return -EINVAL;
+            }
+            break;
+        }
+        if (diagnostics_read_ring_user(device, buffer + n, reader->position, size) != 0)
+        {
+            return -EFAULT;
+        }
+        // overwritten while copying: the next pass copies tail's record over it
+        if (diagnostics_overtaken(reader))
+        {
+            continue;
+        }
+        reader->position += size;
+        n += size;
+    }
+    return n;
+}
+
+static __poll_t diagnostics_poll(struct file * filp, poll_table * wait)
+{
+    diagnostics_reader* reader;
+    __poll_t mask;
+
+    reader = filp->private_data;
+    poll_wait(filp, &reader->device->diagnostics_wait, wait);
+    mask = 0;
+    if (smp_load_acquire(&reader->device->diagnostics_head) != reader->position)
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (reader->device->disconnected)
+    {
+        mask |= EPOLLHUP;
+    }
+    return mask;
+}
+
+static struct file_operations const diagnostics_fops =
+{
+    .owner = THIS_MODULE,
+    .open = diagnostics_open,
+    .release = diagnostics_release,
+    .read = diagnostics_read,
+    .poll = diagnostics_poll,
+};
+
+// Writer of the debugfs replay file; record holds the capture record being
+// written, which may span several write() calls.
+typedef struct _replay_writer
+{
+    device_context* device;
+    report_ring_slot record;
+    unsigned int filled;
+    bool started;
+    u64 first_timestamp;
+    ktime_t start;
+}
+replay_writer;
+
+static int replay_open(struct inode * inode, struct file * filp)
+{
+    replay_writer* writer;
+    device_context* device;
+
+    device = inode->i_private;
+    writer = kzalloc(sizeof(replay_writer), GFP_KERNEL);
+    if (writer == NULL)
+    {
+        return -ENOMEM;
+    }
+    writer->device = device;
+    kref_get(&device->kref);
+    filp->private_data = writer;
+    return nonseekable_open(inode, filp);
+}
+
+static int replay_release(struct inode * inode, struct file * filp)
+{
+    replay_writer* writer;
+
+    writer = filp->private_data;
+    kref_put(&writer->device->kref, touch_delete);
+    kfree(writer);
+    return 0;
+}
+
+// Waits for the replay time of the current record, the first one sets the
+// origin. Disconnect cuts the wait short, its debugfs removal waits for us.
+static int replay_wait(replay_writer* writer)
+{
+    ktime_t deadline;
+    ktime_t timeout;
+    u32 speed;
+    int r;
+
+    if (!writer->started)
+    {
+        writer->started = true;
+        writer->first_timestamp = writer->record.header.timestamp;
+        writer->start = ktime_get();
+        return 0;
+    }
+    speed = READ_ONCE(writer->device->replay_speed);
+    if (speed == 0 || writer->record.header.timestamp <= writer->first_timestamp)
+    {
+        return 0;
+    }
+    deadline = ktime_add_ns(writer->start, div_u64((writer->record.header.timestamp - writer->first_timestamp) * 100, speed));
+    timeout = ktime_sub(deadline, ktime_get());
+    if (ktime_to_ns(timeout) <= 0)
+    {
+        return 0;
+    }
+    r = wait_event_interruptible_hrtimeout(writer->device->replay_queue, writer->device->disconnected, timeout);
+    if (r == -ETIME)
+    {
+        return 0;
+    }
+    return r == 0 ? -ENODEV : r;
+}
+
+// Takes capture records and queues each report once its time has come. A
+// record the writer is interrupted in front of is queued by the next write.
+static ssize_t replay_write(struct file * filp, const char * user_buffer, size_t count, loff_t * ppos)
+{
+    replay_writer* writer;
+    device_context* device;
+    unsigned int size;
+    size_t chunk;
+    size_t n;
+    int r;
+
+    writer = filp->private_data;
+    device = writer->device;
+    n = 0;
+    while (n < count)
+    {
+        size = sizeof(writer->record.header);
+        if (writer->filled >= size)
+        {
+            size += writer->record.header.length;
+        }
+        if (writer->filled < size)
+        {
+            chunk = min_t(size_t, count - n, size - writer->filled);
+            if (copy_from_user((unsigned char*)&writer->record + writer->filled, user_buffer + n, chunk) != 0)
+            {
+                return n != 0 ? n : -EFAULT;
+            }
+            writer->filled += chunk;
+            n += chunk;
+            if (writer->filled == sizeof(writer->record.header) &&
+                (writer->record.header.length == 0 || writer->record.header.length > TOUCH_REPORT_SIZE))
+            {
+                writer->filled = 0;
+                return -EINVAL;
+            }
+            if (writer->filled < sizeof(writer->record.header) || writer->filled < sizeof(writer->record.header) + writer->record.header.length)
+            {
+                continue;
+            }
+        }
+        r = replay_wait(writer);
+        if (r == -ENODEV)
+        {
+            return r;
+        }
+        if (r != 0)
+        {
+            return n != 0 ? n : r;
+        }
+        if (device->disconnected)
+        {
+            return -ENODEV;
+        }
+        receive_report(device, writer->record.data, writer->record.header.length, ktime_get());
+        atomic_long_inc(&device->statistics.reports_replayed);
+        writer->filled = 0;
+    }
+    return n;
+}
+
+static struct file_operations const replay_fops =
+{
+    .owner = THIS_MODULE,
+    .open = replay_open,
+    .release = replay_release,
+    .write = replay_write,
+};
+
+static struct dentry* debugfs_root;
+
+static struct file_operations touch_fops =
+{
+    .owner = THIS_MODULE,
+    .read = touch_read,
+    .write = touch_write,
+    .unlocked_ioctl = touch_unlocked_ioctl,
+    .poll = touch_poll,
+    .mmap = touch_mmap,
+    .open = touch_open,
+    .release = touch_release,
+};
+
+// Leaves an URB the completion handler cannot keep queued to recovery_work.
+static void park_urb(device_context* device, struct urb* urb)
+{
+    unsigned int i;
+
+    for (i = 0; i < device->interrupt_urb_count; i++)
+    {
+        if (device->interrupt_urb[i] == urb)
+        {
+            set_bit(i, &device->parked_urbs);
+            break;
+        }
+    }
+    if (READ_ONCE(device->streaming) && !READ_ONCE(device->suspended))
+    {
+        schedule_delayed_work(&device->recovery_work, 0);
+    }
+}
+
+// Clears a halted endpoint and queues the parked URBs again. Failures back
+// off exponentially and end in a device reset, which rebinds the driver.
+static void recovery_work(struct work_struct* work)
+{
+    device_context* device;
+    unsigned int i;
+    int retval;
+
+    device = container_of(to_delayed_work(work), device_context, recovery_work);
+    // resume queues the whole pool again anyway
+    if (!READ_ONCE(device->streaming) || READ_ONCE(device->suspended))
+    {
+        return;
+    }
+
+    retval = 0;
+    if (test_bit(TOUCH_RECOVERY_CLEAR_HALT, &device->recovery_flags))
+    {
+        // usb_clear_halt() needs an idle endpoint, so the whole pool gets parked
+        cancel_urb(device);
+        for (i = 0; i < device->interrupt_urb_count; i++)
+        {
+            set_bit(i, &device->parked_urbs);
+        }
+        retval = usb_clear_halt(device->usb_device, device->pipe_input);
+        if (retval == 0)
+        {
+            clear_bit(TOUCH_RECOVERY_CLEAR_HALT, &device->recovery_flags);
+            atomic_long_inc(&device->statistics.halts_cleared);
+        }
+    }
+    if (retval == 0)
+    {
+        atomic_set(&device->urb_error_burst, 0);
+        for (i = 0; i < device->interrupt_urb_count; i++)
+        {
+            if (!test_and_clear_bit(i, &device->parked_urbs))
+            {
+                continue;
+            }
+            retval = usb_submit_urb(device->interrupt_urb[i], GFP_KERNEL);
+            if (retval != 0)
+            {
+                set_bit(i, &device->parked_urbs);
+                break;
+            }
+            atomic_long_inc(&device->statistics.urbs_recovered);
+        }
+    }
+    if (retval == 0)
+    {
+        device->recovery_attempts = 0;
+        return;
+    }
+
+    device->recovery_attempts++;
+    err("%s - recovery attempt %u failed, error %d", __func__, device->recovery_attempts, retval);
+    if (device->recovery_attempts < TOUCH_RECOVERY_ATTEMPTS_MAX)
+    {
+        schedule_delayed_work(&device->recovery_work, msecs_to_jiffies(1u << device->recovery_attempts));
+        return;
+    }
+    device->recovery_attempts = 0;
+    atomic_long_inc(&device->statistics.device_resets);
+    usb_queue_reset_device(device->interface);
+}
+
+static void on_interrupt(struct urb* interrupt_urb)
+{
+    device_context* device;
+    ktime_t now;
+    int retval;
+
+    now = ktime_get();
+    device = interrupt_urb->context;
+
+    switch (interrupt_urb->status)
+    {
+    case -ECONNRESET:
+    case -ENOENT:
+    case -ESHUTDOWN:
+        return;
+    }
+    if (interrupt_urb->status != 0)
+    {
+        count_urb_error(device, interrupt_urb->status);
+    }
+    else
+    {
+        atomic_set(&device->urb_error_burst, 0);
+    }
+
+    if (interrupt_urb->status == 0 && interrupt_urb->actual_length > 0)
+    {
+        receive_report(device, interrupt_urb->transfer_buffer, interrupt_urb->actual_length, now);
+        usb_mark_last_busy(device->usb_device);
+    }
+    if (TOUCH_TRACE(urb_complete_enabled)())
+    {
+        TOUCH_TRACE(urb_complete)(device->usb_device, device->report_sequence, report_queue_count(device), interrupt_urb->status, interrupt_urb->actual_length);
+    }
+
+    // a halted endpoint fails every URB until the halt is cleared, and so
+    // does a link that keeps failing without delivering a single report
+    if (interrupt_urb->status == -EPIPE ||
+        (interrupt_urb->status != 0 && atomic_inc_return(&device->urb_error_burst) > TOUCH_URB_ERROR_BURST_MAX))
+    {
+        set_bit(TOUCH_RECOVERY_CLEAR_HALT, &device->recovery_flags);
+        park_urb(device, interrupt_urb);
+        return;
+    }
+
+    // the other URBs of the pool stay queued meanwhile, so this only refills the tail
+    retval = usb_submit_urb(interrupt_urb, GFP_ATOMIC);
+    if (TOUCH_TRACE(urb_submit_enabled)())
+    {
+        TOUCH_TRACE(urb_submit)(device->usb_device, device->report_sequence, report_queue_count(device), retval);
+    }
+    if (retval != 0)
+    {
+        atomic_long_inc(&device->statistics.resubmit_failures);
+        park_urb(device, interrupt_urb);
+    }
+}
+
+static int touch_open_device(struct input_dev * input_dev)
+{
+    device_context* device;
+    int retval;
+
+    device = input_get_drvdata(input_dev);
+    info("%s", __func__);
+
+    retval = usb_autopm_get_interface(device->interface);
+    if (retval != 0)
+    {
+        return retval;
+    }
+    mutex_lock(&device->pm_mutex);
+    device->parked_urbs = 0;
+    device->recovery_flags = 0;
+    device->recovery_attempts = 0;
+    atomic_set(&device->urb_error_burst, 0);
+    WRITE_ONCE(device->streaming, true);
+    retval = submit_urb(device, GFP_KERNEL);
+    if (retval != 0)
+    {
+        WRITE_ONCE(device->streaming, false);
+    }
+    else
+    {
+        // while suspended the board is woken by the next touch
+        device->interface->needs_remote_wakeup = 1;
+    }
+    mutex_unlock(&device->pm_mutex);
+    usb_autopm_put_interface(device->interface);
+    return retval;
+}
+
+static void touch_close_device(struct input_dev * input_dev)
+{
+    device_context* device;
+    int retval;
+
+    device = input_get_drvdata(input_dev);
+    info("%s", __func__);
+
+    // recovery_work checks streaming, so it cannot requeue anything once it is cancelled
+    mutex_lock(&device->pm_mutex);
+    WRITE_ONCE(device->streaming, false);
+    mutex_unlock(&device->pm_mutex);
+    cancel_delayed_work_sync(&device->recovery_work);
+    cancel_urb(device);
+
+    // nothing left to report, so an idle board may sleep without wakeups
+    retval = usb_autopm_get_interface(device->interface);
+    device->interface->needs_remote_wakeup = 0;
+    if (retval == 0)
+    {
+        usb_autopm_put_interface(device->interface);
+    }
+}
+
+static int control_alloc(device_context* device)
+{
+    device->control_buffer = kmalloc(TOUCH_CONTROL_BUFFER_SIZE, GFP_KERNEL);
+    device->control_setup = kmalloc(sizeof(struct usb_ctrlrequest), GFP_KERNEL);
+    device->control_urb = usb_alloc_urb(0, GFP_KERNEL);
+    if (device->control_buffer == NULL || device->control_setup == NULL || device->control_urb == NULL)
+    {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static int interrupt_urbs_alloc(device_context* device)
+{
+    unsigned char* buffer;
+    struct urb* urb;
+    unsigned int i;
+
+    device->interrupt_urb_count = clamp_t(unsigned int, interrupt_urb_count, 1, TOUCH_INTERRUPT_URB_MAX);
+    for (i = 0; i < device->interrupt_urb_count; i++)
+    {
+        urb = usb_alloc_urb(0, GFP_KERNEL);
+        if (urb == NULL)
+        {
+            break;
+        }
+        buffer = usb_alloc_coherent(device->usb_device, TOUCH_REPORT_SIZE, GFP_KERNEL, &urb->transfer_dma);
+        if (buffer == NULL)
+        {
+            usb_free_urb(urb);
+            break;
+        }
+        usb_fill_int_urb(urb, device->usb_device, device->pipe_input, buffer, TOUCH_REPORT_SIZE, on_interrupt, device, device->pipe_interval);
+        urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+        device->interrupt_urb[i] = urb;
+    }
+    if (i < device->interrupt_urb_count)
+    {
+        interrupt_urbs_free(device);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static ssize_t histogram_show(atomic_long_t const* histogram, char* buf)
+{
+    unsigned int i;
+    ssize_t n;
+
+    n = 0;
+    for (i = 0; i < TOUCH_HISTOGRAM_BUCKETS; i++)
+    {
+        n += scnprintf(buf + n, PAGE_SIZE - n, "%lu %ld\n", i == 0 ? 0ul : 1ul << (i - 1), atomic_long_read(&histogram[i]));
+    }
+    return n;
+}
+
+#define STATISTICS_COUNTER_ATTR(name)                                                                       \
+static ssize_t name##_show(struct device* dev, struct device_attribute* attr, char* buf)                    \
+{                                                                                                           \
+    device_context* device;                                                                                 \
+                                                                                                            \
+    device = usb_get_intfdata(to_usb_interface(dev));                                                       \
+    if (device == NULL)                                                                                     \
+    {                                                                                                       \
+        return -ENODEV;                                                                                     \
+    }                                                                                                       \
+    return sprintf(buf, "%ld\n", atomic_long_read(&device->statistics.name));                              \
+}                                                                                                           \
+static DEVICE_ATTR_RO(name)
+
+// "<bucket lower bound> <count>" per line
+#define STATISTICS_HISTOGRAM_ATTR(name, histogram)                                                          \
+static ssize_t name##_show(struct device* dev, struct device_attribute* attr, char* buf)                    \
+{                                                                                                           \
+    device_context* device;                                                                                 \
+                                                                                                            \
+    device = usb_get_intfdata(to_usb_interface(dev));                                                       \
+    if (device == NULL)                                                                                     \
+    {                                                                                                       \
+        return -ENODEV;                                                                                     \
+    }                                                                                                       \
+    return histogram_show(device->statistics.histogram, buf);                                              \
+}                                                                                                           \
+static DEVICE_ATTR_RO(name)
+
+STATISTICS_COUNTER_ATTR(reports_received);
+STATISTICS_COUNTER_ATTR(resubmit_failures);
+STATISTICS_COUNTER_ATTR(halts_cleared);
+STATISTICS_COUNTER_ATTR(urbs_recovered);
+STATISTICS_COUNTER_ATTR(device_resets);
+STATISTICS_COUNTER_ATTR(reads);
+STATISTICS_COUNTER_ATTR(listener_overflow);
+STATISTICS_COUNTER_ATTR(suspends);
+STATISTICS_COUNTER_ATTR(resumes);
+STATISTICS_COUNTER_ATTR(control_cache_hits);
+STATISTICS_COUNTER_ATTR(predictions);
+STATISTICS_COUNTER_ATTR(diagnostic_records);
+// records dropped from the diagnostics stream to make room, whether or not a reader had them
+STATISTICS_COUNTER_ATTR(diagnostic_overwritten);
+// reports queued through debugfs replay, they count as received as well
+STATISTICS_COUNTER_ATTR(reports_replayed);
+
+// in us
+STATISTICS_HISTOGRAM_ATTR(report_interval_us, report_interval);
+STATISTICS_HISTOGRAM_ATTR(report_to_sync_us, report_to_sync);
+// time from a resume to the first report after it, mostly the touch that woke the board
+STATISTICS_HISTOGRAM_ATTR(resume_to_report_us, resume_to_report);
+// in device units, each prediction against where the stroke really was at its target time
+STATISTICS_HISTOGRAM_ATTR(prediction_error, prediction_error);
+
+static ssize_t reports_dropped_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    device_context* device;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    return sprintf(buf, "%u\n", READ_ONCE(device->queue_overflow));
+}
+static DEVICE_ATTR_RO(reports_dropped);
+
+// one "<status> <count>" line per status seen, "other" for the rest
+static ssize_t urb_errors_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    device_context* device;
+    unsigned int i;
+    ssize_t n;
+    long count;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    n = 0;
+    for (i = 0; i < ARRAY_SIZE(urb_error_status); i++)
+    {
+        count = atomic_long_read(&device->statistics.urb_errors[i]);
+        if (count != 0)
+        {
+            n += scnprintf(buf + n, PAGE_SIZE - n, "%d %ld\n", urb_error_status[i], count);
+        }
+    }
+    count = atomic_long_read(&device->statistics.urb_errors[i]);
+    if (count != 0)
+    {
+        n += scnprintf(buf + n, PAGE_SIZE - n, "other %ld\n", count);
+    }
+    return n;
+}
+static DEVICE_ATTR_RO(urb_errors);
+
+// one "<control code type> <count>" line per type seen
+static ssize_t ioctls_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    device_context* device;
+    unsigned int i;
+    ssize_t n;
+    long count;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    n = 0;
+    for (i = 0; i < TOUCH_IOCTL_TYPE_COUNT; i++)
+    {
+        count = atomic_long_read(&device->statistics.ioctls[i]);
+        if (count != 0)
+        {
+            n += scnprintf(buf + n, PAGE_SIZE - n, "0x%08x %ld\n", i << 16, count);
+        }
+    }
+    return n;
+}
+static DEVICE_ATTR_RO(ioctls);
+
+// 0 until the device node exists, not cleared by reset
+static ssize_t probe_to_ready_us_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    device_context* device;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    return sprintf(buf, "%ld\n", READ_ONCE(device->probe_to_ready_us));
+}
+static DEVICE_ATTR_RO(probe_to_ready_us);
+
+static ssize_t reset_store(struct device* dev, struct device_attribute* attr, char const* buf, size_t count)
+{
+    atomic_long_t* counters;
+    device_context* device;
+    unsigned int i;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    // every counter and histogram bucket up to last_report_time
+    BUILD_BUG_ON(offsetof(device_statistics, last_report_time) % sizeof(atomic_long_t) != 0);
+    counters = (atomic_long_t*)&device->statistics;
+    for (i = 0; i < offsetof(device_statistics, last_report_time) / sizeof(atomic_long_t); i++)
+    {
+        atomic_long_set(&counters[i], 0);
+    }
+    spin_lock_irq(&device->lock);
+    device->queue_overflow = 0;
+    WRITE_ONCE(device->ring->overflow, 0);
+    spin_unlock_irq(&device->lock);
+    return count;
+}
+static DEVICE_ATTR_WO(reset);
+
+static struct attribute* statistics_attrs[] =
+{
+    &dev_attr_reports_received.attr,
+    &dev_attr_reports_dropped.attr,
+    &dev_attr_urb_errors.attr,
+    &dev_attr_resubmit_failures.attr,
+    &dev_attr_halts_cleared.attr,
+    &dev_attr_urbs_recovered.attr,
+    &dev_attr_device_resets.attr,
+    &dev_attr_reads.attr,
+    &dev_attr_listener_overflow.attr,
+    &dev_attr_ioctls.attr,
+    &dev_attr_report_interval_us.attr,
+    &dev_attr_report_to_sync_us.attr,
+    &dev_attr_suspends.attr,
+    &dev_attr_resumes.attr,
+    &dev_attr_resume_to_report_us.attr,
+    &dev_attr_control_cache_hits.attr,
+    &dev_attr_predictions.attr,
+    &dev_attr_prediction_error.attr,
+    &dev_attr_diagnostic_records.attr,
+    &dev_attr_diagnostic_overwritten.attr,
+    &dev_attr_reports_replayed.attr,
+    &dev_attr_probe_to_ready_us.attr,
+    &dev_attr_reset.attr,
+    NULL,
+};
+
+static struct attribute_group const statistics_group =
+{
+    .name = "statistics",
+    .attrs = statistics_attrs,
+};
+
+// Nine Q16.16 values, row by row; the last row must be 0 0 65536 and the
+// translations m[2] and m[5] are 65536 per device unit. Identity leaves the
+// coordinates as the server sends them.
+static ssize_t calibration_matrix_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    calibration_matrix matrix;
+    device_context* device;
+    s32 const* m;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    calibration_get(device, &matrix);
+    m = matrix.m;
+    return sprintf(buf, "%d %d %d %d %d %d %d %d %d\n", m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8]);
+}
+static ssize_t calibration_matrix_store(struct device* dev, struct device_attribute* attr, char const* buf, size_t count)
+{
+    calibration_matrix matrix;
+    device_context* device;
+    s32* m;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    m = matrix.m;
+    if (sscanf(buf, "%d %d %d %d %d %d %d %d %d", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5], &m[6], &m[7], &m[8]) != 9)
+    {
+        return -EINVAL;
+    }
+    if (m[6] != 0 || m[7] != 0 || m[8] != TOUCH_CALIBRATION_ONE)
+    {
+        return -EINVAL;
+    }
+    matrix.identity = m[0] == TOUCH_CALIBRATION_ONE && m[1] == 0 && m[2] == 0 &&
+        m[3] == 0 && m[4] == TOUCH_CALIBRATION_ONE && m[5] == 0;
+    write_seqlock(&device->calibration_lock);
+    device->calibration = matrix;
+    write_sequnlock(&device->calibration_lock);
+    return count;
+}
+static DEVICE_ATTR_RW(calibration_matrix);
+
+// Jitter filter parameters, see filter_axis_update(). filter_min_cutoff_mhz
+// 0 turns the filter off, filter_d_cutoff_mhz is the cutoff of the speed estimate.
+#define FILTER_PARAM_ATTR(name, minimum)                                                                    \
+static ssize_t filter_##name##_show(struct device* dev, struct device_attribute* attr, char* buf)          \
+{                                                                                                           \
+    device_context* device;                                                                                 \
+                                                                                                            \
+    device = usb_get_intfdata(to_usb_interface(dev));                                                       \
+    if (device == NULL)                                                                                     \
+    {                                                                                                       \
+        return -ENODEV;                                                                                     \
+    }                                                                                                       \
+    return sprintf(buf, "%u\n", READ_ONCE(device->filter.name));                                           \
+}                                                                                                           \
+static ssize_t filter_##name##_store(struct device* dev, struct device_attribute* attr, char const* buf, size_t count) \
+{                                                                                                           \
+    device_context* device;                                                                                 \
+    unsigned int value;                                                                                     \
+                                                                                                            \
+    device = usb_get_intfdata(to_usb_interface(dev));                                                       \
+    if (device == NULL)                                                                                     \
+    {                                                                                                       \
+        return -ENODEV;                                                                                     \
+    }                                                                                                       \
+    if (kstrtouint(buf, 0, &value) != 0 || value < (minimum))                                              \
+    {                                                                                                       \
+        return -EINVAL;                                                                                     \
+    }                                                                                                       \
+    WRITE_ONCE(device->filter.name, value);                                                                 \
+    return count;                                                                                           \
+}                                                                                                           \
+static DEVICE_ATTR_RW(filter_##name)
+
+FILTER_PARAM_ATTR(min_cutoff_mhz, 0);
+FILTER_PARAM_ATTR(beta, 0);
+FILTER_PARAM_ATTR(d_cutoff_mhz, 1);
+
+// Microseconds contacts are extrapolated ahead, 0 turns prediction off.
+static ssize_t predict_horizon_us_show(struct device* dev, struct device_attribute* attr, char* buf)
+{
+    device_context* device;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    return sprintf(buf, "%u\n", READ_ONCE(device->predict_horizon_us));
+}
+static ssize_t predict_horizon_us_store(struct device* dev, struct device_attribute* attr, char const* buf, size_t count)
+{
+    device_context* device;
+    unsigned int value;
+
+    device = usb_get_intfdata(to_usb_interface(dev));
+    if (device == NULL)
+    {
+        return -ENODEV;
+    }
+    if (kstrtouint(buf, 0, &value) != 0 || value > TOUCH_PREDICT_HORIZON_MAX_US)
+    {
+        return -EINVAL;
+    }
+    WRITE_ONCE(device->predict_horizon_us, value);
+    return count;
+}
+static DEVICE_ATTR_RW(predict_horizon_us);
+
+static struct attribute* settings_attrs[] =
+{
+    &dev_attr_calibration_matrix.attr,
+    &dev_attr_filter_min_cutoff_mhz.attr,
+    &dev_attr_filter_beta.attr,
+    &dev_attr_filter_d_cutoff_mhz.attr,
+    &dev_attr_predict_horizon_us.attr,
+    NULL,
+};
+
+static struct attribute_group const settings_group =
+{
+    .attrs = settings_attrs,
+};
+
+// Creates the device node, the last step of bring-up.
+static int register_node(device_context* device)
+{
+    int retval;
+
+    retval = usb_register_dev(device->interface, &touch_class);
+    if (retval != 0)
+    {
+        err("%s - usb_register_dev failed, error %d", __func__, retval);
+        return retval;
+    }
+    WRITE_ONCE(device->node_registered, true);
+    WRITE_ONCE(device->probe_to_ready_us, (long)ktime_us_delta(ktime_get(), device->probe_time));
+    info("%s - node ready %ld us after probe", __func__, device->probe_to_ready_us);
+    return 0;
+}
+
+static void ready_work(struct work_struct* work)
+{
+    device_context* device;
+
+    device = container_of(to_delayed_work(work), device_context, ready_work);
+    // the board keeps feeding input_dev without a node, the server just cannot attach
+    register_node(device);
+}
+
+static void device_context_init(device_context* obj, struct usb_interface* intf)
+{
+    int i;
+
+    obj->usb_device = usb_get_dev(interface_to_usbdev(intf));
+    obj->interface = intf;
+
+    for (i = 0; i < intf->cur_altsetting->desc.bNumEndpoints; i++)
+    {
+        if (intf->cur_altsetting->endpoint[i].desc.bEndpointAddress & USB_DIR_IN)
+        {
+            obj->pipe_input = usb_rcvintpipe(obj->usb_device, intf->cur_altsetting->endpoint[i].desc.bEndpointAddress);
+            obj->pipe_interval = intf->cur_altsetting->endpoint[i].desc.bInterval;
+            return;
+        }
+    }
+}
+
+static void input_dev_init(struct input_dev* obj, device_context_pool* pool, struct usb_device* usb_device, struct device* parent)
+{
+    if (usb_device->manufacturer != NULL)
+    {
+        strscpy(pool->name, usb_device->manufacturer, sizeof(pool->name));
+    }
+    else
+    {
+        pool->name[0] = 0;
+    }
+
+    if (usb_device->product != NULL)
+    {
+        strlcat(pool->name, " ", sizeof(pool->name));
+        strlcat(pool->name, usb_device->product, sizeof(pool->name));
+    }
+
+    if (strlen(pool->name) == 0)
+    {
+        snprintf(pool->name, sizeof(pool->name), "Optical touch device %04x:%04x", le16_to_cpu(usb_device->descriptor.idVendor), le16_to_cpu(usb_device->descriptor.idProduct));
+    }
+
+    usb_make_path(usb_device, pool->phys, sizeof(pool->phys));
+    strlcat(pool->phys, "/input0", sizeof(pool->phys));
+
+    obj->name = pool->name;
+    obj->phys = pool->phys;
+
+    usb_to_input_id(usb_device, &obj->id);
+    obj->dev.parent = parent;
+
+    //seems useless
+    //input_set_drvdata(obj, device);
+
+    obj->open = touch_open_device;
+    obj->close = touch_close_device;
+
+    obj->evbit[0] = BIT(EV_KEY) | BIT(EV_ABS);
+    set_bit(BTN_TOUCH, obj->keybit);
+    set_bit(EV_SYN, obj->evbit);
+    set_bit(EV_KEY, obj->evbit);
+    set_bit(EV_ABS, obj->evbit);
+    obj->absbit[0] = BIT(ABS_MT_PRESSURE) | BIT(ABS_MT_POSITION_X) | BIT(ABS_MT_POSITION_Y) | BIT(ABS_MT_TOUCH_MAJOR) | BIT(ABS_MT_TOUCH_MINOR);
+
+    input_set_abs_params(obj, ABS_MT_PRESSURE, 0, 1, 0, 0);
+    input_set_abs_params(obj, ABS_MT_POSITION_X, 0, 32767, 0, 0);
+    input_set_abs_params(obj, ABS_MT_POSITION_Y, 0, 32767, 0, 0);
+    input_set_abs_params(obj, ABS_MT_TOUCH_MAJOR, 0, 32767, 0, 0);
+    input_set_abs_params(obj, ABS_MT_TOUCH_MINOR, 0, 32767, 0, 0);
+    input_mt_init_slots(obj, TOUCH_POINT_COUNT, INPUT_MT_DIRECT);
+}
+
+static int touch_probe(struct usb_interface * intf, const struct usb_device_id *id)
+{
+    int retval;
+    device_context * device;
+
+    do
+    {
+        device = kzalloc(sizeof(device_context), GFP_KERNEL);
+        if (device == NULL)
+        {
+            err("%s: Out of memory.", __func__);
+            break;
+        }
+        device->probe_time = ktime_get();
+        do
+        {
+            device_context_init(device, intf);
+            device->input_dev = input_allocate_device();
+            if (device->input_dev == NULL)
+            {
+                break;
+            }
+            do
+            {
+                spin_lock_init(&device->lock);
+                kref_init(&device->kref);
+                mutex_init(&device->io_mutex);
+                mutex_init(&device->pm_mutex);
+                mutex_init(&device->control_mutex);
+                mutex_init(&device->diagnostics_mutex);
+                init_waitqueue_head(&device->diagnostics_wait);
+                init_waitqueue_head(&device->replay_queue);
+                init_waitqueue_head(&device->queue_wait);
+                init_waitqueue_head(&device->listener_wait);
+                INIT_DELAYED_WORK(&device->recovery_work, recovery_work);
+                INIT_DELAYED_WORK(&device->ready_work, ready_work);
+                INIT_DELAYED_WORK(&device->control_timeout_work, control_timeout_work);
+                seqlock_init(&device->calibration_lock);
+                calibration_identity(&device->calibration);
+                // off until a cutoff is set, the rest are the usual 1 euro defaults
+                device->filter.beta = 7;
+                device->filter.d_cutoff_mhz = 1000;
+                if (interrupt_urbs_alloc(device) != 0)
+                {
+                    break;
+                }
+                do
+                {
+                    if (control_alloc(device) != 0 || report_queue_alloc(device) == 0)
+                    {
+                        break;
+                    }
+                    do
+                    {
+                        input_dev_init(device->input_dev, &device->pool, device->usb_device, &intf->dev);
+                        input_set_drvdata(device->input_dev, device);
+                        retval = input_register_device(device->input_dev);
+                        if (retval != 0)
+                        {
+                            break;
+                        }
+                        do
+                        {
+                            usb_set_intfdata(intf, device);
+                            do
+                            {
+                                if (sysfs_create_group(&intf->dev.kobj, &statistics_group) != 0)
+                                {
+                                    break;
+                                }
+                                if (sysfs_create_group(&intf->dev.kobj, &settings_group) != 0)
+                                {
+                                    sysfs_remove_group(&intf->dev.kobj, &statistics_group);
+                                    break;
+                                }
+                                if (settle_delay_ms == 0)
+                                {
+                                    if (register_node(device) != 0)
+                                    {
+                                        sysfs_remove_group(&intf->dev.kobj, &settings_group);
+                                        sysfs_remove_group(&intf->dev.kobj, &statistics_group);
+                                        break;
+                                    }
+                                }
+                                else
+                                {
+                                    schedule_delayed_work(&device->ready_work, msecs_to_jiffies(settle_delay_ms));
+                                }
+                                // debugfs is optional, errors are not worth failing probe
+                                device->debugfs_dir = debugfs_create_dir(dev_name(&intf->dev), debugfs_root);
+                                debugfs_create_file("diagnostics", 0400, device->debugfs_dir, device, &diagnostics_fops);
+                                device->replay_speed = 100;
+                                debugfs_create_file("replay", 0200, device->debugfs_dir, device, &replay_fops);
+                                debugfs_create_u32("replay_speed", 0600, device->debugfs_dir, &device->replay_speed);
+                                // only on request, this overrides power/control as set by the admin
+                                if (autosuspend_delay >= 0)
+                                {
+                                    pm_runtime_set_autosuspend_delay(&device->usb_device->dev, autosuspend_delay * MSEC_PER_SEC);
+                                    usb_enable_autosuspend(device->usb_device);
+                                }
+                                return 0;
+
+
+                            } while (false);
+                            usb_set_intfdata(intf, NULL);
+                        } while (false);
+                        input_unregister_device(device->input_dev);
+                    } while (false);
+                    vfree(device->ring);
+                } while (false);
+                control_free(device);
+                interrupt_urbs_free(device);
+            } while (false);
+            input_free_device(device->input_dev);
+        } while (false);
+        usb_put_dev(device->usb_device);
+        kfree(device);
+    } while (false);
+    return -ENOMEM;
+}
+
+static void touch_disconnect(struct usb_interface * intf)
+{
+    device_context* device = usb_get_intfdata(intf);
+    int minor;
+
+    minor = intf->minor;
+    device = usb_get_intfdata(intf);
+
+    cancel_delayed_work_sync(&device->ready_work);
+    if (device->node_registered)
+    {
+        usb_deregister_dev(intf, &touch_class);
+    }
+    sysfs_remove_group(&intf->dev.kobj, &settings_group);
+    sysfs_remove_group(&intf->dev.kobj, &statistics_group);
+    usb_set_intfdata(intf, NULL);
+
+    // an open file keeps the context alive; it only sees disconnected from now on
+    mutex_lock(&device->io_mutex);
+    device->disconnected = true;
+    input_unregister_device(device->input_dev);
+    mutex_unlock(&device->io_mutex);
+    wake_up_interruptible(&device->queue_wait);
+    wake_up_interruptible(&device->listener_wait);
+    // debugfs removal waits for readers and replay writers, which return once woken
+    wake_up_interruptible(&device->diagnostics_wait);
+    wake_up_interruptible(&device->replay_queue);
+    debugfs_remove_recursive(device->debugfs_dir);
+    // a completion racing with close may have queued it again
+    cancel_delayed_work_sync(&device->recovery_work);
+    // a transfer in progress finishes first, later ones see disconnected
+    mutex_lock(&device->control_mutex);
+    cancel_delayed_work_sync(&device->control_timeout_work);
+    usb_kill_urb(device->control_urb);
+    mutex_unlock(&device->control_mutex);
+
+    kref_put(&device->kref, touch_delete);
+}
+
+// Runtime and system sleep: the pool is killed on suspend and queued again
+// on resume, the ring and the input state are kept.
+static int touch_suspend(struct usb_interface* intf, pm_message_t message)
+{
+    device_context* device;
+
+    device = usb_get_intfdata(intf);
+    // parked URBs stay with the pool, resume queues all of them
+    WRITE_ONCE(device->suspended, true);
+    cancel_delayed_work_sync(&device->recovery_work);
+    cancel_urb(device);
+    // only a system sleep gets here with a control transfer in flight, it completes with ENOENT
+    usb_kill_urb(device->control_urb);
+    atomic_long_inc(&device->statistics.suspends);
+    return 0;
+}
+
+static int touch_resume(struct usb_interface* intf)
+{
+    device_context* device;
+    int retval;
+
+    device = usb_get_intfdata(intf);
+    retval = 0;
+    mutex_lock(&device->pm_mutex);
+    WRITE_ONCE(device->suspended, false);
+    if (device->streaming)
+    {
+        device->parked_urbs = 0;
+        device->recovery_attempts = 0;
+        atomic_set(&device->urb_error_burst, 0);
+        spin_lock_irq(&device->lock);
+        // the sleep is no report interval
+        device->statistics.last_report_time = 0;
+        device->statistics.resume_time = ktime_get();
+        spin_unlock_irq(&device->lock);
+        retval = submit_urb(device, GFP_NOIO);
+    }
+    mutex_unlock(&device->pm_mutex);
+    atomic_long_inc(&device->statistics.resumes);
+    return retval;
+}
+
+static int touch_reset_resume(struct usb_interface* intf)
+{
+    device_context* device;
+
+    device = usb_get_intfdata(intf);
+    // the reset cleared any halt as well
+    device->recovery_flags = 0;
+    return touch_resume(intf);
+}
+
+static struct usb_driver touch_driver =
+{
+    .name = DRIVER_NAME,
+    .probe = touch_probe,
+    .disconnect = touch_disconnect,
+    .suspend = touch_suspend,
+    .resume = touch_resume,
+    .reset_resume = touch_reset_resume,
+    .id_table = dev_table,
+    .supports_autosuspend = 1,
+};
+
+#ifndef TOUCH_KUNIT
+
+static int __init touch_init(void)
+{
+    int retval;
+
+    debugfs_root = debugfs_create_dir(KBUILD_MODNAME, NULL);
+    retval = usb_register(&touch_driver);
+    if (retval != 0)
+    {
+        debugfs_remove_recursive(debugfs_root);
+    }
+    return retval;
+}
+
+static void __exit touch_exit(void)
+{
+    usb_deregister(&touch_driver);
+    debugfs_remove_recursive(debugfs_root);
+}
+
+module_init(touch_init);
+module_exit(touch_exit);
+
+// necessary ?
+MODULE_DEVICE_TABLE(usb, dev_table);
+
+#endif // TOUCH_KUNIT
+
+MODULE_DESCRIPTION(DRIVER_DESCRIPTION);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR(DRIVER_AUTHOR);
@@ -0,0 +1,899 @@
+// KUnit suite of the driver core. OtdDrv_kunit.c and OpticalDrv_kunit.c
+// define a variant descriptor and TOUCH_KUNIT_SUITE, then include this file,
+// which includes the core like a variant does, so the tests call its static
+// functions directly and run once per variant. Each test gets a device
+// context with a report ring and a registered input_dev, but no USB device
+// behind it; an input handler grabs the input_dev and records every event it
+// passes, so the tests assert the exact event sequence a frame produces. The
+// tests use slots 0 and 1 only, which every variant has. See Makefile next
+// to this file.
+
+#define TOUCH_KUNIT
+
+#include "TouchDrvCore.c"
+
+#include <kunit/test.h>
+#include <linux/mman.h>
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0))
+#error "the suite passes user memory to the driver through kunit_vm_mmap(), Linux 6.10 or later"
+#endif
+
+#define TOUCH_TEST_EVENTS_MAX           256
+#define TOUCH_TEST_BENCH_FRAMES         10000
+
+#define TOUCH_TEST_ABS(code, value)     { EV_ABS, ABS_MT_##code, value }
+#define TOUCH_TEST_SYN                  { EV_SYN, SYN_REPORT, 0 }
+
+// Checks and then forgets the events recorded so far.
+#define TOUCH_TEST_EXPECT_EVENTS(context, ...)                                          \
+    do                                                                                  \
+    {                                                                                   \
+        static touch_test_event const expected[] = { __VA_ARGS__ };                    \
+        touch_test_expect_events(context, expected, ARRAY_SIZE(expected));             \
+    } while (false)
+
+typedef struct _touch_test_event
+{
+    unsigned int type;
+    unsigned int code;
+    int value;
+}
+touch_test_event;
+
+typedef struct _touch_test_context
+{
+    struct kunit* test;
+    device_context device;
+    struct usb_bus usb_bus;
+    struct usb_device usb_device;
+    // the primary, opened for writing like the server opens the node
+    file_context file;
+    struct file filp;
+    struct input_handle handle;
+    bool connected;
+    // events past TOUCH_TEST_EVENTS_MAX are counted only
+    touch_test_event events[TOUCH_TEST_EVENTS_MAX];
+    unsigned int event_count;
+}
+touch_test_context;
+
+// the context of the running test, the only input_dev the handler connects to
+static touch_test_context* touch_test_current;
+
+static void touch_test_event_record(struct input_handle* handle, unsigned int type, unsigned int code, int value)
+{
+    touch_test_context* context;
+
+    context = handle->private;
+    if (context->event_count < TOUCH_TEST_EVENTS_MAX)
+    {
+        context->events[context->event_count].type = type;
+        context->events[context->event_count].code = code;
+        context->events[context->event_count].value = value;
+    }
+    context->event_count++;
+}
+
+static bool touch_test_match(struct input_handler* handler, struct input_dev* dev)
+{
+    return touch_test_current != NULL && dev == touch_test_current->device.input_dev;
+}
+
+static int touch_test_connect(struct input_handler* handler, struct input_dev* dev, const struct input_device_id* id)
+{
+    touch_test_context* context;
+    int r;
+
+    context = touch_test_current;
+    context->handle.dev = dev;
+    context->handle.handler = handler;
+    context->handle.name = "touch_kunit";
+    context->handle.private = context;
+    r = input_register_handle(&context->handle);
+    if (r != 0)
+    {
+        return r;
+    }
+    r = input_open_device(&context->handle);
+    if (r != 0)
+    {
+        input_unregister_handle(&context->handle);
+        return r;
+    }
+    // keep the synthetic touches away from evdev and the desktop
+    r = input_grab_device(&context->handle);
+    if (r != 0)
+    {
+        input_close_device(&context->handle);
+        input_unregister_handle(&context->handle);
+        return r;
+    }
+    context->connected = true;
+    return 0;
+}
+
+static void touch_test_disconnect(struct input_handle* handle)
+{
+    touch_test_context* context;
+
+    context = handle->private;
+    input_release_device(handle);
+    input_close_device(handle);
+    input_unregister_handle(handle);
+    context->connected = false;
+}
+
+static struct input_device_id const touch_test_ids[] =
+{
+    { .driver_info = 1 },
+    {}
+};
+
+static struct input_handler touch_test_handler =
+{
+    .event = touch_test_event_record,
+    .match = touch_test_match,
+    .connect = touch_test_connect,
+    .disconnect = touch_test_disconnect,
+    .name = "touch_kunit",
+    .id_table = touch_test_ids,
+};
+
+static void touch_test_expect_events(touch_test_context* context, touch_test_event const* expected, unsigned int count)
+{
+    struct kunit* test;
+    unsigned int i;
+
+    test = context->test;
+    KUNIT_EXPECT_EQ(test, context->event_count, count);
+    for (i = 0; i < min(context->event_count, count); i++)
+    {
+        KUNIT_EXPECT_EQ_MSG(test, context->events[i].type, expected[i].type, "event %u", i);
+        KUNIT_EXPECT_EQ_MSG(test, context->events[i].code, expected[i].code, "event %u", i);
+        KUNIT_EXPECT_EQ_MSG(test, context->events[i].value, expected[i].value, "event %u", i);
+    }
+    context->event_count = 0;
+}
+
+static void touch_test_expect_no_events(touch_test_context* context)
+{
+    KUNIT_EXPECT_EQ(context->test, context->event_count, 0);
+    context->event_count = 0;
+}
+
+// The driver only takes user pointers, so arguments and read buffers live in
+// an anonymous mapping of the test thread.
+static void* touch_test_user(struct kunit* test, unsigned long size)
+{
+    unsigned long address;
+
+    address = kunit_vm_mmap(test, NULL, 0, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0);
+    KUNIT_ASSERT_NE(test, address, 0);
+    return (void*)address;
+}
+
+static void* touch_test_user_copy(struct kunit* test, void const* data, unsigned long size)
+{
+    void* user;
+
+    user = touch_test_user(test, size);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, data, size), 0);
+    return user;
+}
+
+static void touch_test_point(report_packet_multi_touch* packet, unsigned int slot, int x, int y, int width, int height)
+{
+    packet->touchPoint[slot].state = TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED;
+    packet->touchPoint[slot].x = x;
+    packet->touchPoint[slot].y = y;
+    packet->touchPoint[slot].width = width;
+    packet->touchPoint[slot].height = height;
+}
+
+static void touch_test_lift(report_packet_multi_touch* packet, unsigned int slot)
+{
+    packet->touchPoint[slot].state = TOUCH_POINT_IS_VALID;
+}
+
+// Set up like touch_probe() does, without URBs, control transfers, sysfs or a node.
+static int touch_test_init(struct kunit* test)
+{
+    touch_test_context* context;
+    device_context* device;
+    int r;
+
+    context = kunit_kzalloc(test, sizeof(touch_test_context), GFP_KERNEL);
+    if (context == NULL)
+    {
+        return -ENOMEM;
+    }
+    context->test = test;
+    device = &context->device;
+
+    context->usb_bus.bus_name = "kunit";
+    context->usb_device.bus = &context->usb_bus;
+    strscpy(context->usb_device.devpath, "1", sizeof(context->usb_device.devpath));
+    context->usb_device.descriptor.idVendor = cpu_to_le16(dev_table[0].idVendor);
+    context->usb_device.descriptor.idProduct = cpu_to_le16(dev_table[0].idProduct);
+    device->usb_device = &context->usb_device;
+
+    spin_lock_init(&device->lock);
+    kref_init(&device->kref);
+    mutex_init(&device->io_mutex);
+    mutex_init(&device->pm_mutex);
+    mutex_init(&device->control_mutex);
+    mutex_init(&device->diagnostics_mutex);
+    init_waitqueue_head(&device->diagnostics_wait);
+    init_waitqueue_head(&device->replay_queue);
+    init_waitqueue_head(&device->queue_wait);
+    init_waitqueue_head(&device->listener_wait);
+    seqlock_init(&device->calibration_lock);
+    calibration_identity(&device->calibration);
+    device->filter.beta = 7;
+    device->filter.d_cutoff_mhz = 1000;
+    if (report_queue_alloc(device) == 0)
+    {
+        return -ENOMEM;
+    }
+
+    device->input_dev = input_allocate_device();
+    if (device->input_dev == NULL)
+    {
+        vfree(device->ring);
+        return -ENOMEM;
+    }
+    input_dev_init(device->input_dev, &device->pool, device->usb_device, NULL);
+    // there are no URBs to start when the handler opens it
+    device->input_dev->open = NULL;
+    device->input_dev->close = NULL;
+    input_set_drvdata(device->input_dev, device);
+    r = input_register_device(device->input_dev);
+    if (r != 0)
+    {
+        input_free_device(device->input_dev);
+        vfree(device->ring);
+        return r;
+    }
+
+    touch_test_current = context;
+    r = input_register_handler(&touch_test_handler);
+    if (r != 0 || !context->connected)
+    {
+        if (r == 0)
+        {
+            input_unregister_handler(&touch_test_handler);
+            r = -ENODEV;
+        }
+        touch_test_current = NULL;
+        input_unregister_device(device->input_dev);
+        vfree(device->ring);
+        return r;
+    }
+
+    context->file.device = device;
+    context->file.primary = true;
+    context->file.read_format = TOUCH_READ_FORMAT_RAW;
+    device->primary = &context->file;
+    context->filp.private_data = &context->file;
+    context->filp.f_flags = O_NONBLOCK;
+    context->filp.f_mode = FMODE_READ | FMODE_WRITE;
+    test->priv = context;
+    return 0;
+}
+
+static void touch_test_exit(struct kunit* test)
+{
+    touch_test_context* context;
+
+    context = test->priv;
+    input_unregister_handler(&touch_test_handler);
+    touch_test_current = NULL;
+    input_unregister_device(context->device.input_dev);
+    vfree(context->device.ring);
+    kvfree(context->device.batch);
+    vfree(context->device.diagnostics);
+}
+
+static void touch_test_report_multitouch(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_multi_touch packet;
+
+    context = test->priv;
+    memset(&packet, 0, sizeof(packet));
+    touch_test_point(&packet, 0, 100, 200, 30, 40);
+    touch_test_point(&packet, 1, 300, 400, 50, 60);
+    report_multitouch(&context->device, &packet);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 30),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 40),
+        TOUCH_TEST_ABS(POSITION_X, 100),
+        TOUCH_TEST_ABS(POSITION_Y, 200),
+        TOUCH_TEST_ABS(SLOT, 1),
+        TOUCH_TEST_ABS(TRACKING_ID, 1),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 50),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 60),
+        TOUCH_TEST_ABS(POSITION_X, 300),
+        TOUCH_TEST_ABS(POSITION_Y, 400),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(0) | BIT(1));
+
+    // slot 0 lifts, slot 1 moves along x, any other slot stays released
+    touch_test_lift(&packet, 0);
+    packet.touchPoint[1].x = 310;
+    report_multitouch(&context->device, &packet);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(SLOT, 0),
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_ABS(SLOT, 1),
+        TOUCH_TEST_ABS(POSITION_X, 310),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(1));
+
+    // a new stroke in slot 0 gets a new tracking id, an unchanged frame sends nothing
+    touch_test_point(&packet, 0, 120, 200, 30, 40);
+    report_multitouch(&context->device, &packet);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(SLOT, 0),
+        TOUCH_TEST_ABS(TRACKING_ID, 2),
+        TOUCH_TEST_ABS(POSITION_X, 120),
+        TOUCH_TEST_SYN);
+    report_multitouch(&context->device, &packet);
+    touch_test_expect_no_events(context);
+
+    // a slot marked invalid is released like a lift
+    packet.touchPoint[1].state = 0;
+    report_multitouch(&context->device, &packet);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(SLOT, 1),
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(0));
+}
+
+static void touch_test_sync_singletouch(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_single_touch packet;
+    void* user;
+
+    context = test->priv;
+    user = touch_test_user(test, PAGE_SIZE);
+    memset(&packet, 0, sizeof(packet));
+    packet.touchPoint.state = TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED;
+    packet.touchPoint.x = 500;
+    packet.touchPoint.y = 600;
+    packet.touchPoint.width = 10;
+    packet.touchPoint.height = 20;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_singletouch(&context->device, sizeof(packet), user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 10),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 20),
+        TOUCH_TEST_ABS(POSITION_X, 500),
+        TOUCH_TEST_ABS(POSITION_Y, 600),
+        TOUCH_TEST_SYN);
+
+    packet.touchPoint.x = 510;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_singletouch(&context->device, sizeof(packet), user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(POSITION_X, 510),
+        TOUCH_TEST_SYN);
+
+    packet.touchPoint.state = TOUCH_POINT_IS_VALID;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_singletouch(&context->device, sizeof(packet), user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, 0);
+
+    // an invalid point is taken without a frame, a short packet is refused
+    packet.touchPoint.state = 0;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_singletouch(&context->device, sizeof(packet), user), sizeof(packet));
+    KUNIT_EXPECT_EQ(test, sync_singletouch(&context->device, sizeof(packet) - 1, user), 0);
+    touch_test_expect_no_events(context);
+}
+
+static void touch_test_sync_multitouch(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_multi_touch packet;
+    void* user;
+
+    context = test->priv;
+    memset(&packet, 0, sizeof(packet));
+    touch_test_point(&packet, 1, 1000, 2000, 300, 300);
+    user = touch_test_user_copy(test, &packet, sizeof(packet));
+    KUNIT_EXPECT_EQ(test, sync_multitouch(&context->device, sizeof(packet) - 1, user), 0);
+    touch_test_expect_no_events(context);
+    KUNIT_EXPECT_EQ(test, sync_multitouch(&context->device, sizeof(packet), NULL), 0);
+    touch_test_expect_no_events(context);
+
+    KUNIT_EXPECT_EQ(test, sync_multitouch(&context->device, sizeof(packet), user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(SLOT, 1),
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 300),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 300),
+        TOUCH_TEST_ABS(POSITION_X, 1000),
+        TOUCH_TEST_ABS(POSITION_Y, 2000),
+        TOUCH_TEST_SYN);
+
+    touch_test_lift(&packet, 1);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch(&context->device, sizeof(packet), user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_SYN);
+}
+
+static void touch_test_sync_multitouch_sparse(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_sparse_multi_touch packet;
+    unsigned int header;
+    void* user;
+
+    context = test->priv;
+    header = offsetof(report_packet_sparse_multi_touch, touchPoint);
+    user = touch_test_user(test, PAGE_SIZE);
+
+    memset(&packet, 0, sizeof(packet));
+    packet.activeMask = BIT(0) | BIT(1);
+    packet.changedMask = BIT(0) | BIT(1);
+    packet.touchPoint[0] = (report_sparse_touch_point){ 100, 200, 30, 40 };
+    packet.touchPoint[1] = (report_sparse_touch_point){ 700, 800, 50, 60 };
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header + 2 * sizeof(packet.touchPoint[0]), user), header + 2 * sizeof(packet.touchPoint[0]));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 30),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 40),
+        TOUCH_TEST_ABS(POSITION_X, 100),
+        TOUCH_TEST_ABS(POSITION_Y, 200),
+        TOUCH_TEST_ABS(SLOT, 1),
+        TOUCH_TEST_ABS(TRACKING_ID, 1),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 50),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 60),
+        TOUCH_TEST_ABS(POSITION_X, 700),
+        TOUCH_TEST_ABS(POSITION_Y, 800),
+        TOUCH_TEST_SYN);
+
+    // only slot 1 moved, slot 0 keeps its contact
+    packet.changedMask = BIT(1);
+    packet.touchPoint[0] = (report_sparse_touch_point){ 710, 800, 50, 60 };
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header + sizeof(packet.touchPoint[0]), user), header + sizeof(packet.touchPoint[0]));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(POSITION_X, 710),
+        TOUCH_TEST_SYN);
+
+    // slot 0 drops out of activeMask and is released
+    packet.activeMask = BIT(1);
+    packet.changedMask = 0;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header, user), header);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(SLOT, 0),
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(1));
+
+    // a slot entering activeMask without a contact
+    packet.activeMask = BIT(0) | BIT(1);
+    packet.changedMask = 0;
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header, user), 0);
+    // a changed slot outside activeMask
+    packet.activeMask = BIT(1);
+    packet.changedMask = BIT(0) | BIT(1);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header + 2 * sizeof(packet.touchPoint[0]), user), 0);
+    // a slot beyond TOUCH_POINT_COUNT
+    packet.activeMask = BIT(TOUCH_POINT_COUNT) | BIT(1);
+    packet.changedMask = BIT(TOUCH_POINT_COUNT);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header + sizeof(packet.touchPoint[0]), user), 0);
+    // a length that misses the changed contacts, or the header
+    packet.activeMask = BIT(1);
+    packet.changedMask = BIT(1);
+    KUNIT_ASSERT_EQ(test, copy_to_user(user, &packet, sizeof(packet)), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header, user), 0);
+    KUNIT_EXPECT_EQ(test, sync_multitouch_sparse(&context->device, header - 1, user), 0);
+    touch_test_expect_no_events(context);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(1));
+}
+
+static void touch_test_report_skipped_lifts(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_multi_touch* frames;
+
+    context = test->priv;
+    frames = kunit_kzalloc(test, 3 * sizeof(report_packet_multi_touch), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, frames);
+    touch_test_point(&frames[0], 0, 100, 200, 30, 40);
+    report_multitouch(&context->device, &frames[0]);
+    context->event_count = 0;
+
+    // a stroke that stays down across the batch has nothing to add
+    frames[1] = frames[0];
+    frames[2] = frames[0];
+    report_skipped_lifts(&context->device, frames, 3);
+    touch_test_expect_no_events(context);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, BIT(0));
+
+    // slot 0 lifts in the middle frame and touches again in the newest
+    touch_test_lift(&frames[1], 0);
+    frames[2].touchPoint[0].x = 120;
+    report_skipped_lifts(&context->device, frames, 3);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, -1),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, 0);
+    report_multitouch(&context->device, &frames[2]);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 1),
+        TOUCH_TEST_ABS(POSITION_X, 120),
+        TOUCH_TEST_SYN);
+
+    // a lift that lasts into the newest frame is left to that frame
+    touch_test_lift(&frames[2], 0);
+    report_skipped_lifts(&context->device, frames, 3);
+    touch_test_expect_no_events(context);
+}
+
+static void touch_test_filter_axis_update(struct kunit* test)
+{
+    frame_context frame;
+    filter_axis axis;
+    int i;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.filter.min_cutoff_mhz = 1000;
+    frame.filter.beta = 0;
+    frame.filter.d_cutoff_mhz = 1000;
+    frame.interval_us = 10000;
+
+    // a reset starts from the position as it is
+    KUNIT_EXPECT_EQ(test, filter_axis_update(&axis, 1000, true, &frame), 1000);
+    KUNIT_EXPECT_EQ(test, axis.speed, 0);
+    for (i = 0; i < 5; i++)
+    {
+        KUNIT_EXPECT_EQ(test, filter_axis_update(&axis, 1000, false, &frame), 1000);
+    }
+
+    // a 1 Hz cutoff over 10 ms follows a step by about 6 % per frame
+    KUNIT_EXPECT_EQ(test, filter_axis_update(&axis, 1100, false, &frame), 1006);
+    KUNIT_EXPECT_EQ(test, filter_axis_update(&axis, 1100, false, &frame), 1011);
+
+    // beta raises the cutoff with the speed, so the same step is followed faster
+    frame.filter.beta = 7;
+    filter_axis_update(&axis, 1000, true, &frame);
+    KUNIT_EXPECT_EQ(test, filter_axis_update(&axis, 1100, false, &frame), 1024);
+    KUNIT_EXPECT_GT(test, axis.speed, 0);
+}
+
+static void touch_test_predict_contact(struct kunit* test)
+{
+    touch_test_context* context;
+    frame_context frame;
+    int x;
+    int y;
+
+    context = test->priv;
+    memset(&frame, 0, sizeof(frame));
+    frame.predict_horizon_us = 10000;
+
+    // 10 units per ms along x, predicted once three frames are in
+    frame.time = ms_to_ktime(1000);
+    x = 1000;
+    y = 500;
+    predict_contact(&context->device, &frame, 0, true, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1000);
+    frame.time = ms_to_ktime(1010);
+    x = 1100;
+    predict_contact(&context->device, &frame, 0, false, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1100);
+    frame.time = ms_to_ktime(1020);
+    x = 1200;
+    predict_contact(&context->device, &frame, 0, false, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1300);
+    KUNIT_EXPECT_EQ(test, y, 500);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&context->device.statistics.predictions), 1);
+
+    // the stroke reaches the predicted position on time, an error of 0
+    frame.time = ms_to_ktime(1030);
+    x = 1300;
+    predict_contact(&context->device, &frame, 0, false, &x, &y);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&context->device.statistics.prediction_error[0]), 1);
+
+    // a slowing stroke is left where it is
+    frame.time = ms_to_ktime(1000);
+    x = 1000;
+    predict_contact(&context->device, &frame, 1, true, &x, &y);
+    frame.time = ms_to_ktime(1010);
+    x = 1200;
+    predict_contact(&context->device, &frame, 1, false, &x, &y);
+    frame.time = ms_to_ktime(1020);
+    x = 1210;
+    predict_contact(&context->device, &frame, 1, false, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1210);
+
+    // a reset starts over, and a horizon of 0 predicts nothing
+    frame.time = ms_to_ktime(1040);
+    x = 1400;
+    predict_contact(&context->device, &frame, 0, true, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1400);
+    frame.predict_horizon_us = 0;
+    frame.time = ms_to_ktime(1030);
+    x = 1300;
+    predict_contact(&context->device, &frame, 1, true, &x, &y);
+    frame.time = ms_to_ktime(1040);
+    x = 1400;
+    predict_contact(&context->device, &frame, 1, false, &x, &y);
+    frame.time = ms_to_ktime(1050);
+    x = 1500;
+    predict_contact(&context->device, &frame, 1, false, &x, &y);
+    KUNIT_EXPECT_EQ(test, x, 1500);
+}
+
+static void touch_test_calibration_axis(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_multi_touch packet;
+    calibration_matrix matrix;
+
+    KUNIT_EXPECT_EQ(test, calibration_axis((s64)100 << TOUCH_CALIBRATION_SHIFT), 100);
+    KUNIT_EXPECT_EQ(test, calibration_axis(((s64)100 << TOUCH_CALIBRATION_SHIFT) + TOUCH_CALIBRATION_ONE - 1), 100);
+    KUNIT_EXPECT_EQ(test, calibration_axis(-TOUCH_CALIBRATION_ONE), 0);
+    KUNIT_EXPECT_EQ(test, calibration_axis((s64)40000 << TOUCH_CALIBRATION_SHIFT), TOUCH_AXIS_MAX);
+
+    // x and y swapped, which swaps the size as well, and y moved by 50
+    context = test->priv;
+    memset(&matrix, 0, sizeof(matrix));
+    matrix.m[1] = TOUCH_CALIBRATION_ONE;
+    matrix.m[3] = TOUCH_CALIBRATION_ONE;
+    matrix.m[5] = 50 * TOUCH_CALIBRATION_ONE;
+    matrix.m[8] = TOUCH_CALIBRATION_ONE;
+    write_seqlock(&context->device.calibration_lock);
+    context->device.calibration = matrix;
+    write_sequnlock(&context->device.calibration_lock);
+
+    memset(&packet, 0, sizeof(packet));
+    touch_test_point(&packet, 0, 100, 200, 30, 40);
+    report_multitouch(&context->device, &packet);
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 40),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 30),
+        TOUCH_TEST_ABS(POSITION_X, 200),
+        TOUCH_TEST_ABS(POSITION_Y, 150),
+        TOUCH_TEST_SYN);
+}
+
+static void touch_test_ioctl_dispatch(struct kunit* test)
+{
+    touch_test_context* context;
+    report_packet_multi_touch packet;
+    file_context listener;
+    struct file filp;
+    unsigned int code;
+    void* user;
+
+    context = test->priv;
+    memset(&packet, 0, sizeof(packet));
+    touch_test_point(&packet, 0, 100, 200, 30, 40);
+    user = touch_test_user_copy(test, &packet, sizeof(packet));
+    code = TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH) | sizeof(packet);
+
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&context->filp, code, (unsigned long)user), sizeof(packet));
+    TOUCH_TEST_EXPECT_EVENTS(context,
+        TOUCH_TEST_ABS(TRACKING_ID, 0),
+        TOUCH_TEST_ABS(TOUCH_MAJOR, 30),
+        TOUCH_TEST_ABS(TOUCH_MINOR, 40),
+        TOUCH_TEST_ABS(POSITION_X, 100),
+        TOUCH_TEST_ABS(POSITION_Y, 200),
+        TOUCH_TEST_SYN);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&context->device.statistics.ioctls[TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH) >> 16]), 1);
+
+    // codes the driver does not handle return 0 and change nothing
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&context->filp, TOUCH_IOCTL_CODE(TYPE_SYNC_KEYBOARD) | 8, (unsigned long)user), 0);
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&context->filp, 0x007f0000u, (unsigned long)user), 0);
+    touch_test_expect_no_events(context);
+
+    // a listener may choose its read format, but never drive input_dev
+    memset(&listener, 0, sizeof(listener));
+    listener.device = &context->device;
+    memset(&filp, 0, sizeof(filp));
+    filp.private_data = &listener;
+    filp.f_mode = FMODE_READ;
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_SET_READ_FORMAT) | TOUCH_READ_FORMAT_TIMESTAMPED, 0), 0);
+    KUNIT_EXPECT_EQ(test, listener.read_format, TOUCH_READ_FORMAT_TIMESTAMPED);
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_SET_READ_FORMAT) | 7, 0), -EINVAL);
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, code, (unsigned long)user), -EPERM);
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_SET_REPORT) | 8, (unsigned long)user), -EPERM);
+    touch_test_expect_no_events(context);
+
+    // it takes the primary role only while nobody holds it
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_CLAIM_PRIMARY), 0), -EBUSY);
+    KUNIT_EXPECT_FALSE(test, listener.primary);
+    context->device.primary = NULL;
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_CLAIM_PRIMARY), 0), 0);
+    KUNIT_EXPECT_TRUE(test, listener.primary);
+    KUNIT_EXPECT_PTR_EQ(test, context->device.primary, &listener);
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&filp, TOUCH_IOCTL_CODE(TYPE_CLAIM_PRIMARY), 0), 0);
+    context->device.primary = &context->file;
+
+    // an asynchronous GET_REPORT never sends a pending cached selection itself
+    context->device.control_key_length = 1;
+    context->device.control_key_sent = false;
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&context->filp, TOUCH_IOCTL_CODE(TYPE_GET_REPORT) | TOUCH_IOCTL_CODE(FLAG_ASYNC) | 8, (unsigned long)user), -EBUSY);
+    KUNIT_EXPECT_FALSE(test, context->device.control_key_sent);
+    context->device.control_key_length = 0;
+
+    // after a disconnect the sync codes fail without touching input_dev
+    context->device.disconnected = true;
+    KUNIT_EXPECT_EQ(test, touch_unlocked_ioctl(&context->filp, code, (unsigned long)user), -ENODEV);
+    touch_test_expect_no_events(context);
+    context->device.disconnected = false;
+}
+
+static void touch_test_read(struct kunit* test)
+{
+    unsigned char data[TOUCH_REPORT_SIZE];
+    touch_test_context* context;
+    report_ring_slot report;
+    file_context listener;
+    struct file filp;
+    unsigned int i;
+    void* user;
+
+    context = test->priv;
+    user = touch_test_user(test, PAGE_SIZE);
+    memset(&listener, 0, sizeof(listener));
+    listener.device = &context->device;
+    memset(&filp, 0, sizeof(filp));
+    filp.private_data = &listener;
+    filp.f_flags = O_NONBLOCK;
+    filp.f_mode = FMODE_READ;
+
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, TOUCH_REPORT_SIZE, NULL), (ssize_t)-EAGAIN);
+    for (i = 1; i <= 3; i++)
+    {
+        memset(data, i, sizeof(data));
+        receive_report(&context->device, data, sizeof(data), ktime_get());
+    }
+
+    // the primary reads the oldest report first, just the report in the raw format
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, PAGE_SIZE, NULL), (ssize_t)TOUCH_REPORT_SIZE);
+    KUNIT_ASSERT_EQ(test, copy_from_user(data, user, sizeof(data)), 0);
+    KUNIT_EXPECT_EQ(test, data[0], 1);
+    KUNIT_EXPECT_EQ(test, data[TOUCH_REPORT_SIZE - 1], 1);
+    // a shorter buffer takes the start of the report
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, 8, NULL), (ssize_t)8);
+
+    // the timestamped format prefixes the header
+    KUNIT_EXPECT_EQ(test, set_read_format(&context->file, TOUCH_READ_FORMAT_TIMESTAMPED), 0);
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, sizeof(report.header) - 1, NULL), (ssize_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, PAGE_SIZE, NULL), (ssize_t)(sizeof(report.header) + TOUCH_REPORT_SIZE));
+    KUNIT_ASSERT_EQ(test, copy_from_user(&report, user, sizeof(report)), 0);
+    KUNIT_EXPECT_EQ(test, report.header.length, TOUCH_REPORT_SIZE);
+    KUNIT_EXPECT_EQ(test, report.header.sequence, 3);
+    KUNIT_EXPECT_NE(test, report.header.timestamp, 0);
+    KUNIT_EXPECT_EQ(test, report.data[0], 3);
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, PAGE_SIZE, NULL), (ssize_t)-EAGAIN);
+
+    // a listener starts with the next report and does not take it from the primary
+    listener.cursor = context->device.queue_head;
+    KUNIT_EXPECT_EQ(test, touch_read(&filp, user, PAGE_SIZE, NULL), (ssize_t)-EAGAIN);
+    memset(data, 4, sizeof(data));
+    receive_report(&context->device, data, sizeof(data), ktime_get());
+    KUNIT_EXPECT_EQ(test, touch_read(&filp, user, PAGE_SIZE, NULL), (ssize_t)TOUCH_REPORT_SIZE);
+    KUNIT_ASSERT_EQ(test, copy_from_user(data, user, sizeof(data)), 0);
+    KUNIT_EXPECT_EQ(test, data[0], 4);
+    KUNIT_EXPECT_EQ(test, touch_read(&filp, user, PAGE_SIZE, NULL), (ssize_t)-EAGAIN);
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, PAGE_SIZE, NULL), (ssize_t)(sizeof(report.header) + TOUCH_REPORT_SIZE));
+    KUNIT_ASSERT_EQ(test, copy_from_user(&report, user, sizeof(report)), 0);
+    KUNIT_EXPECT_EQ(test, report.header.sequence, 4);
+    KUNIT_EXPECT_EQ(test, atomic_long_read(&context->device.statistics.reads), 5);
+
+    // an empty ring of a gone device ends the reads
+    context->device.disconnected = true;
+    KUNIT_EXPECT_EQ(test, touch_read(&context->filp, user, PAGE_SIZE, NULL), (ssize_t)-ENODEV);
+    context->device.disconnected = false;
+}
+
+static unsigned int const touch_test_bench_contacts[] =
+{
+    1,
+    2,
+#if TOUCH_POINT_COUNT > 2
+    TOUCH_POINT_COUNT,
+#endif
+};
+
+static void touch_test_bench_desc(unsigned int const* contacts, char* desc)
+{
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%u contacts", *contacts);
+}
+
+KUNIT_ARRAY_PARAM(touch_test_bench, touch_test_bench_contacts, touch_test_bench_desc);
+
+// Time per SYNC_MULTITOUCH frame through the ioctl path, with every contact
+// moving, including the delivery of the events to the recording handler.
+static void touch_test_bench_sync_multitouch(struct kunit* test)
+{
+    report_packet_multi_touch packet[2];
+    touch_test_context* context;
+    unsigned int const* contacts;
+    unsigned int failures;
+    unsigned int moves;
+    unsigned int frame;
+    unsigned int code;
+    unsigned int i;
+    u64 start;
+    u64 elapsed;
+    void* user;
+
+    context = test->priv;
+    contacts = test->param_value;
+    memset(packet, 0, sizeof(packet));
+    for (i = 0; i < *contacts; i++)
+    {
+        touch_test_point(&packet[0], i, 1000 + 3000 * i, 1000, 300, 300);
+        touch_test_point(&packet[1], i, 1010 + 3000 * i, 1010, 300, 300);
+    }
+    user = touch_test_user_copy(test, packet, sizeof(packet));
+    code = TOUCH_IOCTL_CODE(TYPE_SYNC_MULTITOUCH) | sizeof(packet[0]);
+
+    failures = 0;
+    start = ktime_get_ns();
+    for (frame = 0; frame < TOUCH_TEST_BENCH_FRAMES; frame++)
+    {
+        if (touch_unlocked_ioctl(&context->filp, code, (unsigned long)((report_packet_multi_touch*)user + (frame & 1))) != sizeof(packet[0]))
+        {
+            failures++;
+        }
+    }
+    elapsed = ktime_get_ns() - start;
+    KUNIT_EXPECT_EQ(test, failures, 0);
+    KUNIT_EXPECT_EQ(test, context->device.active_slots, (unsigned int)(BIT(*contacts) - 1));
+    // the first frame starts every stroke, each later one moves x and y of
+    // every slot, which is selected first unless it is the only one
+    moves = *contacts == 1 ? 3 : 3 * *contacts + 1;
+    KUNIT_EXPECT_EQ(test, context->event_count, 6 * *contacts + (TOUCH_TEST_BENCH_FRAMES - 1) * moves);
+    kunit_info(test, "%u contacts: %llu ns per frame", *contacts, div_u64(elapsed, TOUCH_TEST_BENCH_FRAMES));
+}
+
+static struct kunit_case touch_test_cases[] =
+{
+    KUNIT_CASE(touch_test_report_multitouch),
+    KUNIT_CASE(touch_test_sync_singletouch),
+    KUNIT_CASE(touch_test_sync_multitouch),
+    KUNIT_CASE(touch_test_sync_multitouch_sparse),
+    KUNIT_CASE(touch_test_report_skipped_lifts),
+    KUNIT_CASE(touch_test_filter_axis_update),
+    KUNIT_CASE(touch_test_predict_contact),
+    KUNIT_CASE(touch_test_calibration_axis),
+    KUNIT_CASE(touch_test_ioctl_dispatch),
+    KUNIT_CASE(touch_test_read),
+    KUNIT_CASE_PARAM(touch_test_bench_sync_multitouch, touch_test_bench_gen_params),
+    {}
+};
+
+static struct kunit_suite touch_test_suite =
+{
+    .name = TOUCH_KUNIT_SUITE,
+    .init = touch_test_init,
+    .exit = touch_test_exit,
+    .test_cases = touch_test_cases,
+};
+
+kunit_test_suite(touch_test_suite);
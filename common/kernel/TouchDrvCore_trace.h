@@ -0,0 +1,145 @@
+// Tracepoints of the driver core. The variant descriptor names the trace
+// system and the event prefix, see TouchDrvCore.c.
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM TOUCH_TRACE_SYSTEM
+
+#if !defined(_TOUCH_DRV_CORE_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _TOUCH_DRV_CORE_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+// Every event names the device by bus and address, and carries the sequence
+// number of the raw report it relates to and the number of reports queued.
+// For the ioctl and input events the sequence is that of the report the
+// server consumed last, which links a decoded frame back to its URB.
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(urb_submit),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued, int status),
+    TP_ARGS(usb_device, sequence, queued, status),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+        __field(int, status)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+        __entry->status = status;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u status=%d", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued, __entry->status)
+);
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(urb_complete),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued, int status, unsigned int length),
+    TP_ARGS(usb_device, sequence, queued, status, length),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+        __field(int, status)
+        __field(unsigned int, length)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+        __entry->status = status;
+        __entry->length = length;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u status=%d length=%u", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued, __entry->status, __entry->length)
+);
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(report_dequeue),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued),
+    TP_ARGS(usb_device, sequence, queued),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued)
+);
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(ioctl_enter),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued, unsigned int code),
+    TP_ARGS(usb_device, sequence, queued, code),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+        __field(unsigned int, code)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+        __entry->code = code;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u code=0x%08x", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued, __entry->code)
+);
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(ioctl_exit),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued, unsigned int code, long ret),
+    TP_ARGS(usb_device, sequence, queued, code, ret),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+        __field(unsigned int, code)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+        __entry->code = code;
+        __entry->ret = ret;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u code=0x%08x ret=%ld", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued, __entry->code, __entry->ret)
+);
+
+TRACE_EVENT(TOUCH_TRACE_EVENT(input_sync),
+    TP_PROTO(struct usb_device *usb_device, unsigned int sequence, unsigned int queued, unsigned int contacts),
+    TP_ARGS(usb_device, sequence, queued, contacts),
+    TP_STRUCT__entry(
+        __field(int, busnum)
+        __field(int, devnum)
+        __field(unsigned int, sequence)
+        __field(unsigned int, queued)
+        __field(unsigned int, contacts)
+    ),
+    TP_fast_assign(
+        __entry->busnum = usb_device->bus->busnum;
+        __entry->devnum = usb_device->devnum;
+        __entry->sequence = sequence;
+        __entry->queued = queued;
+        __entry->contacts = contacts;
+    ),
+    TP_printk("%d-%d seq=%u queued=%u contacts=%u", __entry->busnum, __entry->devnum, __entry->sequence, __entry->queued, __entry->contacts)
+);
+
+#endif // _TOUCH_DRV_CORE_TRACE_H_
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE TouchDrvCore_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,709 @@
+// Software stand-in for the 2-camera and 4-camera touch controllers, for
+// load and latency tests of OpticalDrv/OtdDrv without a board.
+//
+// It runs on Raw Gadget, so the emulated controller enumerates on the local
+// host through dummy_hcd with the real VID/PID and a 64 byte interrupt IN
+// endpoint, and the driver binds to it like to real hardware:
+//
+//   modprobe dummy_hcd
+//   modprobe raw_gadget
+//   gcc -O2 -pthread -o touchEmulator touchEmulator.c -lm
+//   ./touchEmulator --variant otd --rate 1000 --contacts 5
+//
+// Vendor control requests, as sent by SET_REPORT and GET_REPORT, are
+// answered by echoing the last SET_REPORT payload. Reports are either
+// synthetic or taken from a capture in the format read() returns in
+// READ_FORMAT_TIMESTAMPED (a report header and the report per record).
+//
+// Synthetic reports are no camera protocol, the closed servers see no
+// touches in them; they carry what a driver benchmark needs, little endian:
+//
+//   offset  0  u32  sequence number, from 1
+//   offset  4  u64  CLOCK_MONOTONIC nanoseconds when the report was queued
+//   offset 12  u8   contact count
+//   offset 13       contacts as state, x, y, width, height (u8, 4 x s16)
+//
+// A replayed capture drives the servers like a real board.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/types.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#define REPORT_SIZE             64
+#define EP0_BUFFER_SIZE         4096
+#define RATE_MIN                60
+#define RATE_MAX                1000
+#define CONTACTS_MAX            5
+#define SYNTHETIC_HEADER_SIZE   13
+#define CONTACT_SIZE            9
+
+#define STRING_ID_MANUFACTURER  1
+#define STRING_ID_PRODUCT       2
+
+// USB_RAW_EVENT_RESET and USB_RAW_EVENT_DISCONNECT, missing from older uapi headers
+#define RAW_EVENT_RESET         5
+#define RAW_EVENT_DISCONNECT    6
+
+typedef struct _emulator_options
+{
+    char const* udc_driver;
+    char const* udc_device;
+    unsigned short vendor;
+    unsigned short product;
+    unsigned int rate;
+    unsigned int contacts;
+    unsigned long long count;
+    char const* replay;
+    unsigned int speed;
+    bool loop;
+}
+emulator_options;
+
+// capture record header, the ReportHeader of OtdDrv.h and OpticalDrv.h
+typedef struct _capture_header
+{
+    uint32_t length;
+    uint32_t sequence;
+    uint64_t timestamp;
+}
+capture_header;
+
+typedef struct _control_event
+{
+    struct usb_raw_event inner;
+    struct usb_ctrlrequest ctrl;
+}
+control_event;
+
+typedef struct _ep_io
+{
+    struct usb_raw_ep_io inner;
+    unsigned char data[EP0_BUFFER_SIZE];
+}
+ep_io;
+
+static emulator_options options =
+{
+    .udc_driver = "dummy_udc",
+    .udc_device = "dummy_udc.0",
+    .vendor = 0x2621,
+    .product = 0x2201,
+    .rate = 120,
+    .contacts = 2,
+    .count = 0,
+    .replay = NULL,
+    .speed = 100,
+    .loop = false,
+};
+
+static int gadget;
+static int endpoint = -1;
+static pthread_t streamer;
+static bool streaming;
+
+// set to end the streamer early, on a bus reset or disconnect
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_stop;
+static bool stopping;
+
+// last SET_REPORT payload, returned by GET_REPORT
+static unsigned char control_data[EP0_BUFFER_SIZE];
+static unsigned int control_length;
+
+static struct usb_device_descriptor device_descriptor =
+{
+    .bLength = USB_DT_DEVICE_SIZE,
+    .bDescriptorType = USB_DT_DEVICE,
+    .bcdUSB = __constant_cpu_to_le16(0x0200),
+    .bDeviceClass = 0,
+    .bDeviceSubClass = 0,
+    .bDeviceProtocol = 0,
+    .bMaxPacketSize0 = 64,
+    .bcdDevice = __constant_cpu_to_le16(0x0100),
+    .iManufacturer = STRING_ID_MANUFACTURER,
+    .iProduct = STRING_ID_PRODUCT,
+    .iSerialNumber = 0,
+    .bNumConfigurations = 1,
+};
+
+static struct usb_config_descriptor config_descriptor =
+{
+    .bLength = USB_DT_CONFIG_SIZE,
+    .bDescriptorType = USB_DT_CONFIG,
+    .wTotalLength = 0,
+    .bNumInterfaces = 1,
+    .bConfigurationValue = 1,
+    .iConfiguration = 0,
+    .bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_WAKEUP,
+    .bMaxPower = 50,
+};
+
+static struct usb_interface_descriptor interface_descriptor =
+{
+    .bLength = USB_DT_INTERFACE_SIZE,
+    .bDescriptorType = USB_DT_INTERFACE,
+    .bInterfaceNumber = 0,
+    .bAlternateSetting = 0,
+    .bNumEndpoints = 1,
+    .bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+    .bInterfaceSubClass = 0,
+    .bInterfaceProtocol = 0,
+    .iInterface = 0,
+};
+
+// bInterval 1 is 125 us at high speed, the report rate is paced by the streamer
+static struct usb_endpoint_descriptor endpoint_descriptor =
+{
+    .bLength = USB_DT_ENDPOINT_SIZE,
+    .bDescriptorType = USB_DT_ENDPOINT,
+    .bEndpointAddress = USB_DIR_IN | 1,
+    .bmAttributes = USB_ENDPOINT_XFER_INT,
+    .wMaxPacketSize = __constant_cpu_to_le16(REPORT_SIZE),
+    .bInterval = 1,
+};
+
+static void fail(char const* what)
+{
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Returns false when the streamer is told to stop before the deadline.
+static bool sleep_until(uint64_t deadline)
+{
+    struct timespec t;
+    bool stop;
+
+    t.tv_sec = deadline / 1000000000ull;
+    t.tv_nsec = deadline % 1000000000ull;
+    pthread_mutex_lock(&stream_lock);
+    while (!stopping && pthread_cond_timedwait(&stream_stop, &stream_lock, &t) != ETIMEDOUT)
+    {
+    }
+    stop = stopping;
+    pthread_mutex_unlock(&stream_lock);
+    return !stop;
+}
+
+// Blocks until the host has taken the report; false once the endpoint is gone.
+static bool send_report(unsigned char const* data, unsigned int length)
+{
+    ep_io io;
+
+    io.inner.ep = endpoint;
+    io.inner.flags = 0;
+    io.inner.length = length;
+    memcpy(io.data, data, length);
+    if (ioctl(gadget, USB_RAW_IOCTL_EP_WRITE, &io) < 0)
+    {
+        if (errno != ESHUTDOWN && errno != ECONNRESET)
+        {
+            perror("USB_RAW_IOCTL_EP_WRITE");
+        }
+        return false;
+    }
+    return true;
+}
+
+static void put_u16(unsigned char* p, uint16_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = value >> 8;
+}
+
+// Contacts move on circles around the screen centre, one turn every two seconds.
+static void stream_synthetic(void)
+{
+    unsigned char report[REPORT_SIZE];
+    unsigned long long sequence;
+    unsigned char* contact;
+    uint64_t period;
+    uint64_t next;
+    uint64_t now;
+    unsigned int i;
+    double phase;
+    int j;
+
+    period = 1000000000ull / options.rate;
+    next = monotonic_ns();
+    for (sequence = 1; options.count == 0 || sequence <= options.count; sequence++)
+    {
+        if (!sleep_until(next))
+        {
+            return;
+        }
+        next += period;
+        now = monotonic_ns();
+        memset(report, 0, sizeof(report));
+        for (j = 0; j < 4; j++)
+        {
+            report[j] = (sequence >> (8 * j)) & 0xff;
+        }
+        for (j = 0; j < 8; j++)
+        {
+            report[4 + j] = (now >> (8 * j)) & 0xff;
+        }
+        report[12] = options.contacts;
+        for (i = 0; i < options.contacts; i++)
+        {
+            phase = 2 * M_PI * ((double)(now % 2000000000ull) / 2e9 + (double)i / options.contacts);
+            contact = report + SYNTHETIC_HEADER_SIZE + i * CONTACT_SIZE;
+            contact[0] = 0x03;
+            put_u16(contact + 1, (uint16_t)(16384 + 12000 * cos(phase)));
+            put_u16(contact + 3, (uint16_t)(16384 + 12000 * sin(phase)));
+            put_u16(contact + 5, 300);
+            put_u16(contact + 7, 300);
+        }
+        if (!send_report(report, sizeof(report)))
+        {
+            return;
+        }
+    }
+}
+
+// Sends the capture's reports spaced like their timestamps, scaled by --speed.
+static void stream_capture(void)
+{
+    unsigned char report[REPORT_SIZE];
+    capture_header header;
+    unsigned long long sent;
+    uint64_t first;
+    uint64_t start;
+    FILE* capture;
+
+    capture = fopen(options.replay, "rb");
+    if (capture == NULL)
+    {
+        fail(options.replay);
+    }
+    sent = 0;
+    do
+    {
+        rewind(capture);
+        first = 0;
+        start = monotonic_ns();
+        while (fread(&header, sizeof(header), 1, capture) == 1)
+        {
+            if (header.length == 0 || header.length > REPORT_SIZE || fread(report, header.length, 1, capture) != 1)
+            {
+                fprintf(stderr, "%s: malformed record after %llu reports\n", options.replay, sent);
+                fclose(capture);
+                return;
+            }
+            if (first == 0)
+            {
+                first = header.timestamp;
+            }
+            if (options.speed != 0 && header.timestamp > first && !sleep_until(start + (header.timestamp - first) * 100 / options.speed))
+            {
+                fclose(capture);
+                return;
+            }
+            if (!send_report(report, header.length))
+            {
+                fclose(capture);
+                return;
+            }
+            sent++;
+            if (options.count != 0 && sent >= options.count)
+            {
+                fclose(capture);
+                return;
+            }
+        }
+    } while (options.loop);
+    fclose(capture);
+}
+
+static void* stream(void* unused)
+{
+    if (options.replay != NULL)
+    {
+        stream_capture();
+    }
+    else
+    {
+        stream_synthetic();
+    }
+    return NULL;
+}
+
+static unsigned int string_descriptor(unsigned char index, unsigned char* buffer)
+{
+    char const* text;
+    unsigned int i;
+
+    if (index == 0)
+    {
+        buffer[0] = 4;
+        buffer[1] = USB_DT_STRING;
+        put_u16(buffer + 2, 0x0409);
+        return 4;
+    }
+    text = index == STRING_ID_MANUFACTURER ? "Touch emulator" : "Optical touch screen";
+    buffer[1] = USB_DT_STRING;
+    for (i = 0; text[i] != 0; i++)
+    {
+        put_u16(buffer + 2 + 2 * i, (unsigned char)text[i]);
+    }
+    buffer[0] = 2 + 2 * i;
+    return buffer[0];
+}
+
+static unsigned int config_descriptors(unsigned char* buffer)
+{
+    unsigned int length;
+
+    length = sizeof(config_descriptor) + sizeof(interface_descriptor) + USB_DT_ENDPOINT_SIZE;
+    config_descriptor.wTotalLength = __cpu_to_le16(length);
+    memcpy(buffer, &config_descriptor, sizeof(config_descriptor));
+    memcpy(buffer + sizeof(config_descriptor), &interface_descriptor, sizeof(interface_descriptor));
+    memcpy(buffer + sizeof(config_descriptor) + sizeof(interface_descriptor), &endpoint_descriptor, USB_DT_ENDPOINT_SIZE);
+    return length;
+}
+
+// Picks the UDC's interrupt IN endpoint, dummy_hcd has fixed endpoint numbers.
+static void choose_endpoint(void)
+{
+    struct usb_raw_eps_info info;
+    int count;
+    int i;
+
+    memset(&info, 0, sizeof(info));
+    count = ioctl(gadget, USB_RAW_IOCTL_EPS_INFO, &info);
+    if (count < 0)
+    {
+        fail("USB_RAW_IOCTL_EPS_INFO");
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (info.eps[i].caps.type_int && info.eps[i].caps.dir_in)
+        {
+            endpoint_descriptor.bEndpointAddress = USB_DIR_IN | (info.eps[i].addr == USB_RAW_EP_ADDR_ANY ? 1 : info.eps[i].addr);
+            return;
+        }
+    }
+    fprintf(stderr, "%s has no interrupt IN endpoint\n", options.udc_device);
+    exit(EXIT_FAILURE);
+}
+
+static void configure(void)
+{
+    if (streaming)
+    {
+        return;
+    }
+    endpoint = ioctl(gadget, USB_RAW_IOCTL_EP_ENABLE, &endpoint_descriptor);
+    if (endpoint < 0)
+    {
+        fail("USB_RAW_IOCTL_EP_ENABLE");
+    }
+    if (ioctl(gadget, USB_RAW_IOCTL_VBUS_DRAW, config_descriptor.bMaxPower) < 0)
+    {
+        fail("USB_RAW_IOCTL_VBUS_DRAW");
+    }
+    if (ioctl(gadget, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+    {
+        fail("USB_RAW_IOCTL_CONFIGURE");
+    }
+    streaming = true;
+    if (pthread_create(&streamer, NULL, stream, NULL) != 0)
+    {
+        fail("pthread_create");
+    }
+}
+
+// Ends the streamer after a bus reset or disconnect and drops its endpoint, the
+// next SET_CONFIGURATION enables it again.
+static void unconfigure(void)
+{
+    if (!streaming)
+    {
+        return;
+    }
+    pthread_mutex_lock(&stream_lock);
+    stopping = true;
+    pthread_cond_broadcast(&stream_stop);
+    pthread_mutex_unlock(&stream_lock);
+    pthread_join(streamer, NULL);
+    // the UDC may already have disabled it, so errors are of no interest
+    ioctl(gadget, USB_RAW_IOCTL_EP_DISABLE, endpoint);
+    endpoint = -1;
+    stopping = false;
+    streaming = false;
+}
+
+// Fills io for the data stage of ctrl; returns false to stall the request.
+static bool handle_control(struct usb_ctrlrequest const* ctrl, ep_io* io)
+{
+    unsigned short length;
+
+    length = __le16_to_cpu(ctrl->wLength);
+    io->inner.length = 0;
+    if ((ctrl->bRequestType & USB_TYPE_MASK) == USB_TYPE_VENDOR)
+    {
+        if ((ctrl->bRequestType & USB_DIR_IN) != 0)
+        {
+            memcpy(io->data, control_data, control_length);
+            io->inner.length = length < control_length ? length : control_length;
+        }
+        else
+        {
+            if (length > EP0_BUFFER_SIZE)
+            {
+                return false;
+            }
+            io->inner.length = length;
+        }
+        return true;
+    }
+    if ((ctrl->bRequestType & USB_TYPE_MASK) != USB_TYPE_STANDARD)
+    {
+        return false;
+    }
+    switch (ctrl->bRequest)
+    {
+    case USB_REQ_GET_DESCRIPTOR:
+        switch (__le16_to_cpu(ctrl->wValue) >> 8)
+        {
+        case USB_DT_DEVICE:
+            memcpy(io->data, &device_descriptor, sizeof(device_descriptor));
+            io->inner.length = sizeof(device_descriptor);
+            break;
+        case USB_DT_CONFIG:
+            io->inner.length = config_descriptors(io->data);
+            break;
+        case USB_DT_STRING:
+            io->inner.length = string_descriptor(__le16_to_cpu(ctrl->wValue) & 0xff, io->data);
+            break;
+        default:
+            return false;
+        }
+        if (io->inner.length > length)
+        {
+            io->inner.length = length;
+        }
+        return true;
+    case USB_REQ_SET_CONFIGURATION:
+        configure();
+        return true;
+    case USB_REQ_GET_STATUS:
+        memset(io->data, 0, 2);
+        io->inner.length = length < 2 ? length : 2;
+        return true;
+    case USB_REQ_SET_INTERFACE:
+    case USB_REQ_CLEAR_FEATURE:
+    case USB_REQ_SET_FEATURE:
+        return true;
+    }
+    return false;
+}
+
+static void run(void)
+{
+    control_event event;
+    ep_io io;
+    int r;
+
+    for (;;)
+    {
+        event.inner.type = 0;
+        event.inner.length = sizeof(event.ctrl);
+        if (ioctl(gadget, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0)
+        {
+            fail("USB_RAW_IOCTL_EVENT_FETCH");
+        }
+        if (event.inner.type == USB_RAW_EVENT_CONNECT)
+        {
+            choose_endpoint();
+            continue;
+        }
+        if (event.inner.type == RAW_EVENT_RESET || event.inner.type == RAW_EVENT_DISCONNECT)
+        {
+            unconfigure();
+            continue;
+        }
+        if (event.inner.type != USB_RAW_EVENT_CONTROL)
+        {
+            continue;
+        }
+        if (!handle_control(&event.ctrl, &io))
+        {
+            ioctl(gadget, USB_RAW_IOCTL_EP0_STALL, 0);
+            continue;
+        }
+        io.inner.ep = 0;
+        io.inner.flags = 0;
+        if ((event.ctrl.bRequestType & USB_DIR_IN) != 0)
+        {
+            r = ioctl(gadget, USB_RAW_IOCTL_EP0_WRITE, &io);
+        }
+        else
+        {
+            r = ioctl(gadget, USB_RAW_IOCTL_EP0_READ, &io);
+            if (r >= 0 && (event.ctrl.bRequestType & USB_TYPE_MASK) == USB_TYPE_VENDOR)
+            {
+                memcpy(control_data, io.data, r);
+                control_length = r;
+            }
+        }
+        if (r < 0)
+        {
+            perror("ep0 data stage");
+        }
+    }
+}
+
+static void usage(char const* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --variant otd|optical   VID/PID of the 4-camera (default) or 2-camera controller\n"
+        "  --vid ID --pid ID       explicit VID/PID\n"
+        "  --rate HZ               synthetic report rate, %u to %u (default 120)\n"
+        "  --contacts N            synthetic contacts per report, 0 to %u (default 2)\n"
+        "  --count N               stop after N reports (default endless)\n"
+        "  --replay FILE           send the reports of a timestamped capture instead\n"
+        "  --speed PERCENT         replay pace, 0 as fast as the host polls (default 100)\n"
+        "  --loop                  replay the capture over and over\n"
+        "  --udc-driver NAME       UDC driver (default dummy_udc)\n"
+        "  --udc-device NAME       UDC instance (default dummy_udc.0)\n",
+        name, RATE_MIN, RATE_MAX, CONTACTS_MAX);
+    exit(EXIT_FAILURE);
+}
+
+static void parse_options(int argc, char** argv)
+{
+    static struct option const long_options[] =
+    {
+        { "variant", required_argument, NULL, 'v' },
+        { "vid", required_argument, NULL, 'V' },
+        { "pid", required_argument, NULL, 'P' },
+        { "rate", required_argument, NULL, 'r' },
+        { "contacts", required_argument, NULL, 'c' },
+        { "count", required_argument, NULL, 'n' },
+        { "replay", required_argument, NULL, 'f' },
+        { "speed", required_argument, NULL, 's' },
+        { "loop", no_argument, NULL, 'l' },
+        { "udc-driver", required_argument, NULL, 'D' },
+        { "udc-device", required_argument, NULL, 'd' },
+        { NULL, 0, NULL, 0 },
+    };
+    int option;
+
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'v':
+            if (strcmp(optarg, "otd") == 0)
+            {
+                options.vendor = 0x2621;
+                options.product = 0x2201;
+            }
+            else if (strcmp(optarg, "optical") == 0)
+            {
+                options.vendor = 0x6615;
+                options.product = 0x0084;
+            }
+            else
+            {
+                usage(argv[0]);
+            }
+            break;
+        case 'V':
+            options.vendor = strtoul(optarg, NULL, 16);
+            break;
+        case 'P':
+            options.product = strtoul(optarg, NULL, 16);
+            break;
+        case 'r':
+            options.rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            options.contacts = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            options.count = strtoull(optarg, NULL, 0);
+            break;
+        case 'f':
+            options.replay = optarg;
+            break;
+        case 's':
+            options.speed = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            options.loop = true;
+            break;
+        case 'D':
+            options.udc_driver = optarg;
+            break;
+        case 'd':
+            options.udc_device = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (options.rate < RATE_MIN || options.rate > RATE_MAX || options.contacts > CONTACTS_MAX)
+    {
+        usage(argv[0]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    struct usb_raw_init init;
+    pthread_condattr_t attributes;
+
+    parse_options(argc, argv);
+    device_descriptor.idVendor = __cpu_to_le16(options.vendor);
+    device_descriptor.idProduct = __cpu_to_le16(options.product);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&stream_stop, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    gadget = open("/dev/raw-gadget", O_RDWR);
+    if (gadget < 0)
+    {
+        fail("/dev/raw-gadget");
+    }
+    memset(&init, 0, sizeof(init));
+    strncpy((char*)init.driver_name, options.udc_driver, UDC_NAME_LENGTH_MAX - 1);
+    strncpy((char*)init.device_name, options.udc_device, UDC_NAME_LENGTH_MAX - 1);
+    init.speed = USB_SPEED_HIGH;
+    if (ioctl(gadget, USB_RAW_IOCTL_INIT, &init) < 0)
+    {
+        fail("USB_RAW_IOCTL_INIT");
+    }
+    if (ioctl(gadget, USB_RAW_IOCTL_RUN, 0) < 0)
+    {
+        fail("USB_RAW_IOCTL_RUN");
+    }
+    printf("Emulating %04x:%04x on %s\n", options.vendor, options.product, options.udc_device);
+    run();
+    return 0;
+}
@@ -0,0 +1,605 @@
+// Records decoded touch frames from the evdev node of a board and plays them
+// back through SYNC_MULTITOUCH of OtdDrv/OpticalDrv, for compositor and
+// application tests without a person at the board.
+//
+//   gcc -O2 -o touchReplay touchReplay.c
+//   ./touchReplay record /dev/input/eventX gesture.tframes --variant otd
+//   ./touchReplay replay gesture.tframes --node /dev/OtdUsbRaw000 --speed 200
+//   ./touchReplay stress /dev/input/eventX --node /dev/OtdUsbRaw000 --variant otd
+//
+// File format, little endian: a frame_file_header, then one frame_record per
+// SYN_REPORT, each followed by the report packet of the header's point count,
+// OtdReportPacketMultiTouch or OpticalReportPacketMultiTouch. Positions are
+// in the driver's 0..32767 input range, so a board recorded with the identity
+// calibration replays as captured.
+//
+// replay and stress have to be the primary of the driver node, stop the server
+// first. stress encodes the frame number in the X of slot 0 and needs the
+// identity calibration and the filter and prediction off.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+
+#define FRAME_FILE_MAGIC                0x4d415246u     // "FRAM"
+#define FRAME_FILE_VERSION              1
+
+#define IOCTL_CODE_TYPE_SYNC_MULTITOUCH 0x00220000u
+#define TOUCH_POINT_IS_VALID            0x01
+#define TOUCH_POINT_IS_TOUCHED          0x02
+#define TOUCH_POINT_COUNT_MAX           10
+#define EVENT_BUFFER_COUNT              256
+#define STRESS_FRAME_WINDOW             16384
+
+#pragma pack(1)
+
+typedef struct _frame_file_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t points;
+}
+frame_file_header;
+
+// timestamp is the CLOCK_MONOTONIC time of the SYN_REPORT in nanoseconds
+typedef struct _frame_record
+{
+    uint64_t timestamp;
+}
+frame_record;
+
+// ReportTouchPoint of OtdDrv.h and OpticalDrv.h
+typedef struct _touch_point
+{
+    uint8_t state;
+    int16_t x;
+    int16_t y;
+    int16_t width;
+    int16_t height;
+}
+touch_point;
+
+typedef struct _touch_packet
+{
+    touch_point touchPoint[TOUCH_POINT_COUNT_MAX];
+    uint16_t scanTime;
+}
+touch_packet;
+
+#pragma pack()
+
+typedef struct _replay_options
+{
+    char const* node;
+    unsigned int points;
+    unsigned int speed;
+    bool loop;
+    unsigned int max_rate;
+    unsigned int seconds;
+}
+replay_options;
+
+static replay_options options =
+{
+    .node = NULL,
+    .points = 2,
+    .speed = 100,
+    .loop = false,
+    .max_rate = 4000,
+    .seconds = 2,
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline)
+{
+    struct timespec t;
+
+    t.tv_sec = deadline / 1000000000ull;
+    t.tv_nsec = deadline % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+    {
+    }
+}
+
+static unsigned int packet_size(void)
+{
+    return sizeof(touch_point) * options.points + sizeof(uint16_t);
+}
+
+// The scan time sits behind the point count of the variant, not at touch_packet.scanTime.
+static void set_scan_time(touch_packet* packet, uint16_t scan_time)
+{
+    memcpy(&packet->touchPoint[options.points], &scan_time, sizeof(scan_time));
+}
+
+static int open_node(void)
+{
+    int fd;
+
+    fd = open(options.node, O_RDWR);
+    if (fd < 0)
+    {
+        perror(options.node);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static int open_event(char const* path, bool grab)
+{
+    int clock;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+    if (grab && ioctl(fd, EVIOCGRAB, 1) < 0)
+    {
+        perror("EVIOCGRAB");
+    }
+    return fd;
+}
+
+static int sync_multitouch(int node, touch_packet const* packet)
+{
+    return ioctl(node, IOCTL_CODE_TYPE_SYNC_MULTITOUCH | packet_size(), packet);
+}
+
+// Tracks the MT slots of the evdev stream and writes one record per SYN_REPORT.
+static int record(char const* event_path, char const* file_path)
+{
+    struct input_event ev[EVENT_BUFFER_COUNT];
+    frame_file_header header;
+    touch_packet packet;
+    frame_record frame;
+    unsigned long long frames;
+    bool incomplete;
+    FILE* file;
+    int slot;
+    int fd;
+    int rd;
+    int i;
+
+    fd = open_event(event_path, false);
+    file = fopen(file_path, "wb");
+    if (file == NULL)
+    {
+        perror(file_path);
+        return EXIT_FAILURE;
+    }
+    header.magic = FRAME_FILE_MAGIC;
+    header.version = FRAME_FILE_VERSION;
+    header.points = options.points;
+    fwrite(&header, sizeof(header), 1, file);
+
+    memset(&packet, 0, sizeof(packet));
+    slot = 0;
+    frames = 0;
+    incomplete = false;
+    fprintf(stderr, "Recording %s to %s ... (interrupt to stop)\n", event_path, file_path);
+    for (;;)
+    {
+        rd = read(fd, ev, sizeof(ev));
+        if (rd < (int)sizeof(struct input_event))
+        {
+            perror("read");
+            break;
+        }
+        for (i = 0; i < rd / (int)sizeof(struct input_event); i++)
+        {
+            if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+            {
+                fprintf(stderr, "SYN_DROPPED after %llu frames, the next frame is skipped\n", frames);
+                incomplete = true;
+                continue;
+            }
+            if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT)
+            {
+                if (!incomplete)
+                {
+                    frame.timestamp = (uint64_t)ev[i].input_event_sec * 1000000000ull + ev[i].input_event_usec * 1000ull;
+                    set_scan_time(&packet, (uint16_t)(frame.timestamp / 100000));
+                    fwrite(&frame, sizeof(frame), 1, file);
+                    fwrite(&packet, packet_size(), 1, file);
+                    fflush(file);
+                    frames++;
+                }
+                incomplete = false;
+                continue;
+            }
+            if (ev[i].type != EV_ABS)
+            {
+                continue;
+            }
+            if (ev[i].code == ABS_MT_SLOT)
+            {
+                slot = ev[i].value;
+                continue;
+            }
+            if (slot < 0 || slot >= (int)options.points)
+            {
+                continue;
+            }
+            switch (ev[i].code)
+            {
+            case ABS_MT_TRACKING_ID:
+                packet.touchPoint[slot].state = ev[i].value < 0 ? 0 : TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED;
+                break;
+            case ABS_MT_POSITION_X:
+                packet.touchPoint[slot].x = ev[i].value;
+                break;
+            case ABS_MT_POSITION_Y:
+                packet.touchPoint[slot].y = ev[i].value;
+                break;
+            case ABS_MT_TOUCH_MAJOR:
+                packet.touchPoint[slot].width = ev[i].value;
+                break;
+            case ABS_MT_TOUCH_MINOR:
+                packet.touchPoint[slot].height = ev[i].value;
+                break;
+            }
+        }
+    }
+    fclose(file);
+    return EXIT_SUCCESS;
+}
+
+// Sends the recorded frames spaced like their timestamps, scaled by --speed.
+static int replay(char const* file_path)
+{
+    frame_file_header header;
+    touch_packet packet;
+    frame_record frame;
+    unsigned long long frames;
+    unsigned long long failed;
+    unsigned long long late;
+    uint64_t first;
+    uint64_t start;
+    uint64_t deadline;
+    FILE* file;
+    int node;
+
+    file = fopen(file_path, "rb");
+    if (file == NULL)
+    {
+        perror(file_path);
+        return EXIT_FAILURE;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != FRAME_FILE_MAGIC || header.version != FRAME_FILE_VERSION)
+    {
+        fprintf(stderr, "%s is no touch frame recording\n", file_path);
+        return EXIT_FAILURE;
+    }
+    if (header.points != options.points)
+    {
+        fprintf(stderr, "%s holds %u touch points, the driver takes %u\n", file_path, header.points, options.points);
+        return EXIT_FAILURE;
+    }
+    node = open_node();
+    frames = 0;
+    failed = 0;
+    late = 0;
+    do
+    {
+        fseek(file, sizeof(header), SEEK_SET);
+        first = 0;
+        start = monotonic_ns();
+        memset(&packet, 0, sizeof(packet));
+        while (fread(&frame, sizeof(frame), 1, file) == 1 && fread(&packet, packet_size(), 1, file) == 1)
+        {
+            if (first == 0)
+            {
+                first = frame.timestamp;
+            }
+            if (options.speed != 0 && frame.timestamp > first)
+            {
+                deadline = start + (frame.timestamp - first) * 100 / options.speed;
+                if (monotonic_ns() > deadline + 1000000)
+                {
+                    late++;
+                }
+                sleep_until(deadline);
+            }
+            if (sync_multitouch(node, &packet) < 0)
+            {
+                failed++;
+            }
+            frames++;
+        }
+        // lift every contact, so a loop or the end leaves no touch behind
+        memset(&packet, 0, sizeof(packet));
+        sync_multitouch(node, &packet);
+    } while (options.loop);
+    close(node);
+    fclose(file);
+    printf("frames=%llu failed=%llu late_over_1ms=%llu\n", frames, failed, late);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+typedef struct _stress_result
+{
+    // frames the driver accepted and injection ioctls it failed
+    unsigned int sent;
+    unsigned int failed;
+    // accepted frames the reader saw, missed without and after a SYN_DROPPED
+    unsigned int delivered;
+    unsigned int lost;
+    unsigned int dropped;
+    double achieved_rate;
+}
+stress_result;
+
+// Consumes the events that are ready, counting frames by the number in the X
+// of slot 0. Only accepted frames are numbered, so a gap is never a failed ioctl.
+static void stress_collect(int event, int* slot, int* slot_x, unsigned int* next_frame, bool* resync, stress_result* result)
+{
+    struct input_event ev[EVENT_BUFFER_COUNT];
+    unsigned int frame;
+    unsigned int gap;
+    int rd;
+    int i;
+
+    for (;;)
+    {
+        rd = read(event, ev, sizeof(ev));
+        if (rd < (int)sizeof(struct input_event))
+        {
+            return;
+        }
+        for (i = 0; i < rd / (int)sizeof(struct input_event); i++)
+        {
+            if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+            {
+                *resync = true;
+                continue;
+            }
+            if (ev[i].type == EV_ABS && ev[i].code == ABS_MT_SLOT)
+            {
+                *slot = ev[i].value;
+                continue;
+            }
+            if (ev[i].type == EV_ABS && ev[i].code == ABS_MT_POSITION_X && *slot == 0)
+            {
+                *slot_x = ev[i].value;
+                continue;
+            }
+            // the lift between steps carries no frame number
+            if (ev[i].type == EV_ABS && ev[i].code == ABS_MT_TRACKING_ID && *slot == 0 && ev[i].value < 0)
+            {
+                *slot_x = -1;
+                continue;
+            }
+            if (ev[i].type != EV_SYN || ev[i].code != SYN_REPORT || *slot_x < 1)
+            {
+                continue;
+            }
+            frame = (unsigned int)(*slot_x - 1);
+            gap = (frame - *next_frame) % STRESS_FRAME_WINDOW;
+            // frames missed with a SYN_DROPPED were dropped by evdev, the others
+            // were lost on the way, e.g. merged into a later input_sync
+            if (*resync)
+            {
+                result->dropped += gap;
+                *resync = false;
+            }
+            else
+            {
+                result->lost += gap;
+            }
+            result->delivered++;
+            *next_frame = (frame + 1) % STRESS_FRAME_WINDOW;
+        }
+    }
+}
+
+static void stress_step(int node, int event, unsigned int contacts, unsigned int rate, stress_result* result)
+{
+    touch_packet packet;
+    struct timeval timeout;
+    fd_set readable;
+    unsigned int frames;
+    unsigned int frame;
+    unsigned int next_frame;
+    unsigned int i;
+    uint64_t period;
+    uint64_t start;
+    uint64_t next;
+    bool resync;
+    int slot_x;
+    int slot;
+
+    memset(result, 0, sizeof(*result));
+    frames = rate * options.seconds;
+    period = 1000000000ull / rate;
+    slot = 0;
+    slot_x = -1;
+    next_frame = 0;
+    resync = false;
+    memset(&packet, 0, sizeof(packet));
+    start = monotonic_ns();
+    next = start;
+    for (frame = 0; frame < frames; frame++)
+    {
+        sleep_until(next);
+        next += period;
+        for (i = 0; i < contacts; i++)
+        {
+            packet.touchPoint[i].state = TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED;
+            packet.touchPoint[i].x = 1 + (result->sent + i * 1000) % STRESS_FRAME_WINDOW;
+            packet.touchPoint[i].y = 1000 + i * 3000;
+            packet.touchPoint[i].width = 200;
+            packet.touchPoint[i].height = 200;
+        }
+        set_scan_time(&packet, (uint16_t)frame);
+        if (sync_multitouch(node, &packet) >= 0)
+        {
+            result->sent++;
+        }
+        else
+        {
+            result->failed++;
+        }
+        stress_collect(event, &slot, &slot_x, &next_frame, &resync, result);
+    }
+    result->achieved_rate = result->sent * 1e9 / (monotonic_ns() - start);
+
+    // collect the tail, then lift the contacts for the next step
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 100000;
+    FD_ZERO(&readable);
+    FD_SET(event, &readable);
+    while (select(event + 1, &readable, NULL, NULL, &timeout) > 0)
+    {
+        stress_collect(event, &slot, &slot_x, &next_frame, &resync, result);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 100000;
+        FD_ZERO(&readable);
+        FD_SET(event, &readable);
+    }
+    // accepted frames after the last delivered one never made it
+    result->lost += (result->sent - next_frame) % STRESS_FRAME_WINDOW;
+    memset(&packet, 0, sizeof(packet));
+    sync_multitouch(node, &packet);
+    stress_collect(event, &slot, &slot_x, &next_frame, &resync, result);
+}
+
+// Sweeps 1..points contacts at doubling rates from 125 Hz up to --max-rate.
+static int stress(char const* event_path)
+{
+    stress_result result;
+    unsigned int contacts;
+    unsigned int rate;
+    int event;
+    int node;
+    int flags;
+
+    event = open_event(event_path, true);
+    flags = fcntl(event, F_GETFL);
+    fcntl(event, F_SETFL, flags | O_NONBLOCK);
+    node = open_node();
+    printf("contacts,rate,achieved_rate,sent,failed,delivered,lost,dropped\n");
+    for (contacts = 1; contacts <= options.points; contacts++)
+    {
+        for (rate = 125; rate <= options.max_rate; rate *= 2)
+        {
+            stress_step(node, event, contacts, rate, &result);
+            printf("%u,%u,%.1f,%u,%u,%u,%u,%u\n", contacts, rate, result.achieved_rate, result.sent, result.failed, result.delivered, result.lost, result.dropped);
+            fflush(stdout);
+        }
+    }
+    close(node);
+    close(event);
+    return EXIT_SUCCESS;
+}
+
+static void usage(char const* name)
+{
+    fprintf(stderr,
+        "Usage: %s record EVENT FILE [options]\n"
+        "       %s replay FILE [options]\n"
+        "       %s stress EVENT [options]\n"
+        "  --variant otd|optical   touch point count and default node (default optical)\n"
+        "  --node PATH             driver node (default /dev/IRTouchOptical000 or /dev/OtdUsbRaw000)\n"
+        "  --speed PERCENT         replay pace, 0 as fast as possible (default 100)\n"
+        "  --loop                  replay the recording over and over\n"
+        "  --max-rate HZ           highest stress frame rate (default 4000)\n"
+        "  --seconds N             duration of each stress step (default 2)\n",
+        name, name, name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    static struct option const long_options[] =
+    {
+        { "variant", required_argument, NULL, 'v' },
+        { "node", required_argument, NULL, 'n' },
+        { "speed", required_argument, NULL, 's' },
+        { "loop", no_argument, NULL, 'l' },
+        { "max-rate", required_argument, NULL, 'm' },
+        { "seconds", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+    char const* command;
+    bool otd;
+    int option;
+
+    otd = false;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'v':
+            if (strcmp(optarg, "otd") != 0 && strcmp(optarg, "optical") != 0)
+            {
+                usage(argv[0]);
+            }
+            otd = strcmp(optarg, "otd") == 0;
+            break;
+        case 'n':
+            options.node = optarg;
+            break;
+        case 's':
+            options.speed = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            options.loop = true;
+            break;
+        case 'm':
+            options.max_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            options.seconds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    options.points = otd ? 10 : 2;
+    if (options.node == NULL)
+    {
+        options.node = otd ? "/dev/OtdUsbRaw000" : "/dev/IRTouchOptical000";
+    }
+    if (optind >= argc || options.seconds == 0)
+    {
+        usage(argv[0]);
+    }
+    command = argv[optind];
+    if (strcmp(command, "record") == 0 && argc - optind == 3)
+    {
+        return record(argv[optind + 1], argv[optind + 2]);
+    }
+    if (strcmp(command, "replay") == 0 && argc - optind == 2)
+    {
+        return replay(argv[optind + 1]);
+    }
+    if (strcmp(command, "stress") == 0 && argc - optind == 2)
+    {
+        return stress(argv[optind + 1]);
+    }
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -1,30 +1,106 @@
+
 #include <stdint.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <linux/input.h>
 
-typedef struct point { 
-    int x; 
-    int y; 
-    int id; 
+// Benchmark mode: frames are injected with SYNC_MULTITOUCH on the driver node
+// and matched to the SYN_REPORT they cause on its evdev node. The frame number
+// modulo FRAME_WINDOW is encoded in the X of slot 0, so the calibration matrix
+// must be the identity and the filter and prediction off. The benchmark has to
+// be the primary of the driver node, stop the server first.
+
+#define EVENT_BUFFER_COUNT	256
+#define FRAME_WINDOW		16384
+#define MAX_CONTACTS		10
+#define MAX_SLOTS		16
+
+// SYNC_MULTITOUCH control code and packet, see OpticalDrv.h and OtdDrv.h
+#define IOCTL_CODE_TYPE_SYNC_MULTITOUCH	0x00220000u
+#define TOUCH_POINT_IS_VALID		0x01
+#define TOUCH_POINT_IS_TOUCHED		0x02
+
+#pragma pack(1)
+typedef struct touch_point {
+	unsigned char state;
+	signed short x;
+	signed short y;
+	signed short width;
+	signed short height;
+} touch_point;
+#pragma pack()
+
+typedef struct point {
+    int x;
+    int y;
+    int id;
 }point;
 
-int main (int argc, char **argv)
+typedef struct bench_options {
+	const char *node;
+	const char *event;
+	unsigned int points;
+	unsigned int rate;
+	unsigned int contacts;
+	unsigned int frames;
+	unsigned int warmup;
+	int json;
+} bench_options;
+
+static bench_options options = {
+	.node = NULL,
+	.event = NULL,
+	.points = 2,
+	.rate = 120,
+	.contacts = 1,
+	.frames = 10000,
+	.warmup = 100,
+	.json = 0,
+};
+
+// written by the injector before the frame's ioctl, read by the reader after its SYN_REPORT
+static uint64_t inject_ns[FRAME_WINDOW];
+static unsigned int inject_frame[FRAME_WINDOW];
+static volatile int injecting;
+static uint64_t inject_start;
+static uint64_t inject_end;
+static unsigned int injected;
+static unsigned int inject_errors;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull +
+		(uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+static int print_events(const char *path)
 {
 	char name[256] = "Unknown";
 	int fd, rd, i;
-	struct input_event ev[64];
-	struct point tmpP;
-
-	if (argc < 2) {
-		printf("Usage: evtest /dev/input/eventX\n");
-		return 1;
-	}
+	struct input_event ev[EVENT_BUFFER_COUNT];
+	struct point tmpP = { 0, 0, -1 };
 
-	if ((fd = open(argv[argc - 1], O_RDONLY)) < 0) {
+	if ((fd = open(path, O_RDONLY)) < 0) {
 		perror("Getevent");
 		return 1;
 	}
@@ -33,17 +109,17 @@ int main (int argc, char **argv)
 
 	printf("Reading input from device ... (interrupt to exit)\n");
 	while (1) { // Main loop
-		rd = read(fd, ev, sizeof(struct input_event) * 64);
+		rd = read(fd, ev, sizeof(ev));
 		if (rd < (int) sizeof(struct input_event)) {
 			perror("\nGetevent: error reading");
 			return 1;
 		}
 		for (i = 0; i < rd / sizeof(struct input_event); i++) {
 			if (ev[i].type == EV_ABS){
-					if (ev[i].code == ABS_MT_TRACKING_ID) tmpP.id = ev[i].value; 
+					if (ev[i].code == ABS_MT_TRACKING_ID) tmpP.id = ev[i].value;
 					if (ev[i].code == ABS_MT_POSITION_X) tmpP.x  = ev[i].value;
 					if (ev[i].code == ABS_MT_POSITION_Y) {
-						tmpP.y  = ev[i].value;	
+						tmpP.y  = ev[i].value;
                     				printf("Touch ID:%d   X:%d   Y:%d\n",tmpP.id,tmpP.x,tmpP.y);
 					}
 			}
@@ -51,3 +127,290 @@ int main (int argc, char **argv)
 	}
 }
 
+// Every contact moves each frame, so evdev never filters the frame out as unchanged.
+static void build_frame(touch_point *packet, unsigned int frame)
+{
+	unsigned int i;
+
+	memset(packet, 0, sizeof(touch_point) * options.points + 2);
+	for (i = 0; i < options.contacts; i++) {
+		packet[i].state = TOUCH_POINT_IS_VALID | TOUCH_POINT_IS_TOUCHED;
+		packet[i].x = 1 + (frame + i * 1000) % FRAME_WINDOW;
+		packet[i].y = 1000 + i * 3000;
+		packet[i].width = 200;
+		packet[i].height = 200;
+	}
+	// scanTime
+	memcpy(&packet[options.points], &frame, 2);
+}
+
+static void *inject(void *arg)
+{
+	touch_point packet[MAX_CONTACTS + 1];
+	unsigned int code, frame, length, total;
+	struct timespec t;
+	uint64_t next, period;
+	int fd = *(int *)arg;
+
+	length = sizeof(touch_point) * options.points + 2;
+	code = IOCTL_CODE_TYPE_SYNC_MULTITOUCH | length;
+	total = options.warmup + options.frames;
+	period = options.rate ? 1000000000ull / options.rate : 0;
+	next = monotonic_ns();
+	inject_start = next;
+	for (frame = 0; frame < total && injecting; frame++) {
+		if (period) {
+			t.tv_sec = next / 1000000000ull;
+			t.tv_nsec = next % 1000000000ull;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+			next += period;
+		}
+		build_frame(packet, frame);
+		__atomic_store_n(&inject_frame[frame % FRAME_WINDOW], frame, __ATOMIC_RELAXED);
+		__atomic_store_n(&inject_ns[frame % FRAME_WINDOW], monotonic_ns(), __ATOMIC_RELEASE);
+		if (ioctl(fd, code, packet) < 0)
+			inject_errors++;
+		injected++;
+	}
+	inject_end = monotonic_ns();
+	injecting = 0;
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, unsigned int count, double p)
+{
+	unsigned int i;
+
+	if (count == 0)
+		return 0;
+	i = (unsigned int)(p / 100.0 * (count - 1) + 0.5);
+	return sorted[i] / 1000.0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s /dev/input/eventX\n"
+		"       %s --bench [options] /dev/input/eventX\n"
+		"  --variant otd|optical   driver node and touch point count (default optical)\n"
+		"  --node PATH             driver node (default /dev/IRTouchOptical000)\n"
+		"  --rate HZ               injected frames per second, 0 back to back (default 120)\n"
+		"  --contacts N            contacts per frame (default 1)\n"
+		"  --frames N              measured frames (default 10000)\n"
+		"  --warmup N              frames injected before measuring (default 100)\n"
+		"  --json                  print the results as one JSON object\n",
+		name, name);
+	exit(1);
+}
+
+static int bench(void)
+{
+	struct input_event ev[EVENT_BUFFER_COUNT];
+	int slot_x[MAX_SLOTS], slot_id[MAX_SLOTS];
+	unsigned int matched = 0, unmatched = 0, dropped = 0, syncs = 0;
+	unsigned int frame, i, key, last = 0;
+	int node, fd, rd, slot = 0, clock = CLOCK_MONOTONIC, skip = 0;
+	uint64_t *latency, now, cpu, sent, first_ns = 0, last_ns = 0;
+	double seconds, delivered;
+	pthread_t injector;
+
+	latency = malloc(sizeof(uint64_t) * options.frames);
+	if (latency == NULL) {
+		perror("Getevent");
+		return 1;
+	}
+	if ((fd = open(options.event, O_RDONLY)) < 0) {
+		perror(options.event);
+		return 1;
+	}
+	ioctl(fd, EVIOCSCLOCKID, &clock);
+	// keep the synthetic touches away from the desktop
+	if (ioctl(fd, EVIOCGRAB, 1) < 0)
+		perror("EVIOCGRAB");
+	if ((node = open(options.node, O_RDWR)) < 0) {
+		perror(options.node);
+		return 1;
+	}
+	for (i = 0; i < MAX_SLOTS; i++) {
+		slot_x[i] = -1;
+		slot_id[i] = -1;
+	}
+
+	cpu = cpu_ns();
+	injecting = 1;
+	if (pthread_create(&injector, NULL, inject, &node) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+	while (matched < options.frames) {
+		struct timeval timeout = { 0, 200000 };
+		fd_set readable;
+
+		FD_ZERO(&readable);
+		FD_SET(fd, &readable);
+		if (select(fd + 1, &readable, NULL, NULL, &timeout) <= 0) {
+			// the injector has finished and nothing arrived for 200 ms
+			if (!injecting)
+				break;
+			continue;
+		}
+		rd = read(fd, ev, sizeof(ev));
+		now = monotonic_ns();
+		if (rd < (int) sizeof(struct input_event)) {
+			perror("Getevent: error reading");
+			break;
+		}
+		for (i = 0; i < rd / sizeof(struct input_event); i++) {
+			if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED) {
+				dropped++;
+				skip = 1;
+				continue;
+			}
+			if (ev[i].type == EV_ABS) {
+				if (ev[i].code == ABS_MT_SLOT)
+					slot = ev[i].value < MAX_SLOTS ? ev[i].value : 0;
+				if (ev[i].code == ABS_MT_TRACKING_ID)
+					slot_id[slot] = ev[i].value;
+				if (ev[i].code == ABS_MT_POSITION_X)
+					slot_x[slot] = ev[i].value;
+				continue;
+			}
+			if (ev[i].type != EV_SYN || ev[i].code != SYN_REPORT)
+				continue;
+			syncs++;
+			// events up to the SYN_REPORT after SYN_DROPPED are incomplete
+			if (skip) {
+				skip = 0;
+				continue;
+			}
+			if (slot_id[0] < 0 || slot_x[0] < 1) {
+				unmatched++;
+				continue;
+			}
+			key = (slot_x[0] - 1) % FRAME_WINDOW;
+			frame = __atomic_load_n(&inject_frame[key], __ATOMIC_RELAXED);
+			sent = __atomic_load_n(&inject_ns[key], __ATOMIC_ACQUIRE);
+			if (sent == 0 || sent > now || (matched && frame <= last)) {
+				unmatched++;
+				continue;
+			}
+			last = frame;
+			if (frame >= options.warmup && matched < options.frames) {
+				if (matched == 0)
+					first_ns = now;
+				last_ns = now;
+				latency[matched++] = now - sent;
+			}
+		}
+	}
+	injecting = 0;
+	pthread_join(injector, NULL);
+	cpu = cpu_ns() - cpu;
+	ioctl(fd, EVIOCGRAB, 0);
+	close(node);
+	close(fd);
+
+	qsort(latency, matched, sizeof(uint64_t), compare_u64);
+	seconds = (inject_end - inject_start) / 1e9;
+	// matched frames per second between the first and last one received
+	delivered = matched > 1 && last_ns > first_ns ? (matched - 1) / ((last_ns - first_ns) / 1e9) : 0;
+	if (options.json) {
+		printf("{\"node\":\"%s\",\"rate\":%u,\"contacts\":%u,\"injected\":%u,\"inject_errors\":%u,"
+			"\"matched\":%u,\"unmatched\":%u,\"syn_dropped\":%u,\"syn_reports\":%u,"
+			"\"frames_per_second\":%.1f,\"inject_rate\":%.1f,\"cpu_us_per_frame\":%.2f,"
+			"\"latency_us\":{\"min\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p99_9\":%.1f,\"max\":%.1f}}\n",
+			options.node, options.rate, options.contacts, injected, inject_errors,
+			matched, unmatched, dropped, syncs,
+			delivered, seconds > 0 ? injected / seconds : 0, injected ? cpu / 1000.0 / injected : 0,
+			percentile_us(latency, matched, 0), percentile_us(latency, matched, 50),
+			percentile_us(latency, matched, 99), percentile_us(latency, matched, 99.9),
+			percentile_us(latency, matched, 100));
+	} else {
+		printf("node              %s\n", options.node);
+		printf("rate              %u Hz, %u contacts\n", options.rate, options.contacts);
+		printf("injected          %u (%u failed)\n", injected, inject_errors);
+		printf("matched           %u, %u unmatched, %u SYN_DROPPED\n", matched, unmatched, dropped);
+		printf("frames/s          %.1f delivered\n", delivered);
+		printf("injected/s        %.1f\n", seconds > 0 ? injected / seconds : 0);
+		printf("cpu/frame         %.2f us\n", injected ? cpu / 1000.0 / injected : 0);
+		printf("latency p50       %.1f us\n", percentile_us(latency, matched, 50));
+		printf("latency p99       %.1f us\n", percentile_us(latency, matched, 99));
+		printf("latency p99.9     %.1f us\n", percentile_us(latency, matched, 99.9));
+		printf("latency max       %.1f us\n", percentile_us(latency, matched, 100));
+	}
+	free(latency);
+	return matched == options.frames && inject_errors == 0 ? 0 : 2;
+}
+
+int main (int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "bench", no_argument, NULL, 'b' },
+		{ "variant", required_argument, NULL, 'v' },
+		{ "node", required_argument, NULL, 'n' },
+		{ "rate", required_argument, NULL, 'r' },
+		{ "contacts", required_argument, NULL, 'c' },
+		{ "frames", required_argument, NULL, 'f' },
+		{ "warmup", required_argument, NULL, 'w' },
+		{ "json", no_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int option, benchmark = 0;
+
+	while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (option) {
+		case 'b':
+			benchmark = 1;
+			break;
+		case 'v':
+			if (strcmp(optarg, "otd") == 0) {
+				options.points = 10;
+				if (options.node == NULL)
+					options.node = "/dev/OtdUsbRaw000";
+			} else if (strcmp(optarg, "optical") == 0) {
+				options.points = 2;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case 'n':
+			options.node = optarg;
+			break;
+		case 'r':
+			options.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			options.contacts = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			options.frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			options.warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			options.json = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (!benchmark)
+		return print_events(argv[optind]);
+
+	options.event = argv[optind];
+	if (options.node == NULL)
+		options.node = "/dev/IRTouchOptical000";
+	if (options.contacts < 1 || options.contacts > options.points || options.frames == 0)
+		usage(argv[0]);
+	return bench();
+}
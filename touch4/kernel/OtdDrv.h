@@ -3,6 +3,7 @@
 
 #define DEVICE_NODE_FORMAT    "OtdUsbRaw%03d"
 #define OTD_TOUCH_POINT_COUNT 10
+#define OTD_REPORT_SIZE       64
 
 #pragma pack(1)
 
@@ -37,16 +38,98 @@ OtdReportPacketMultiTouch;
 
 #pragma pack()
 
+// Prefix of every queued raw report. sequence counts every report received
+// from the device, so a gap means reports were dropped. timestamp is the
+// CLOCK_MONOTONIC time of the URB completion in nanoseconds.
+typedef struct _OtdReportHeader
+{
+    unsigned int length;
+    unsigned int sequence;
+    unsigned long long timestamp;
+}
+OtdReportHeader;
+
+// Raw report ring shared with the server through mmap() of the device node.
+// The header sits at offset 0 and the slots start at slotOffset. The driver
+// advances head after a slot is complete; the reader advances tail after it
+// has consumed a slot. Indices run free and are masked with slotCount - 1.
+// While the ring is mapped, a full ring drops the incoming report instead of
+// the oldest one and counts it in overflow. A tail that points outside the
+// reports still in the ring is taken as the nearest end of them.
+typedef struct _OtdReportRingSlot
+{
+    OtdReportHeader header;
+    unsigned char data[OTD_REPORT_SIZE];
+}
+OtdReportRingSlot;
+
+typedef struct _OtdReportRing
+{
+    unsigned int head;
+    unsigned int tail;
+    unsigned int slotCount;
+    unsigned int slotSize;
+    unsigned int slotOffset;
+    unsigned int overflow;
+}
+OtdReportRing;
+
+// SYNC_MULTITOUCH_SPARSE packet. Bit n of activeMask is set for every slot
+// touching after this frame, changedMask is the subset whose contact follows,
+// in ascending slot order. Slots that drop out of activeMask are released and
+// slots outside changedMask keep their last contact, so a slot entering
+// activeMask must be in changedMask as well. The control code length only has
+// to cover the header and the changed contacts.
+typedef struct _OtdReportSparseTouchPoint
+{
+    signed short x;
+    signed short y;
+    signed short width;
+    signed short height;
+}
+OtdReportSparseTouchPoint;
+
+typedef struct _OtdReportPacketSparseMultiTouch
+{
+    unsigned short activeMask;
+    unsigned short changedMask;
+    unsigned short scanTime;
+    unsigned short reserved;
+    OtdReportSparseTouchPoint touchPoint[OTD_TOUCH_POINT_COUNT];
+}
+OtdReportPacketSparseMultiTouch;
+
+// Record of the diagnostics stream, <debugfs>/<module>/<interface>/diagnostics.
+// SYNC_DIAGNOSIS, SYNC_RAWTOUCH and SYNC_TOUCH append their argument as one
+// record of the given control code type. sequence counts every record, so a
+// gap means the reader was overtaken and lost the oldest records. timestamp
+// is CLOCK_MONOTONIC in nanoseconds. The data is padded to a multiple of 8.
+typedef struct _OtdDiagnosticHeader
+{
+    unsigned int type;
+    unsigned int length;
+    unsigned int sequence;
+    unsigned int reserved;
+    unsigned long long timestamp;
+}
+OtdDiagnosticHeader;
+
 //control code
 #define OTD_IOCTL_CODE_TYPE_MASK                        0x00ff0000u
 
 #define OTD_IOCTL_CODE_TYPE_SET_REPORT                  0x00100000u
 #define OTD_IOCTL_CODE_TYPE_GET_REPORT                  0x00110000u
+#define OTD_IOCTL_CODE_TYPE_SET_READ_FORMAT             0x00120000u
+#define OTD_IOCTL_CODE_TYPE_GET_OVERFLOW                0x00130000u
+#define OTD_IOCTL_CODE_TYPE_GET_CONTROL_RESULT          0x00140000u
+#define OTD_IOCTL_CODE_TYPE_CLAIM_PRIMARY               0x00150000u
 
 #define OTD_IOCTL_CODE_TYPE_SYNC_ABSOLUTEMOUSE          0x00200000u
 #define OTD_IOCTL_CODE_TYPE_SYNC_SINGLETOUCH            0x00210000u
 #define OTD_IOCTL_CODE_TYPE_SYNC_MULTITOUCH             0x00220000u
 #define OTD_IOCTL_CODE_TYPE_SYNC_KEYBOARD               0x00230000u
+#define OTD_IOCTL_CODE_TYPE_SYNC_MULTITOUCH_BATCH       0x00240000u
+#define OTD_IOCTL_CODE_TYPE_SYNC_MULTITOUCH_SPARSE      0x00250000u
 
 #define OTD_IOCTL_CODE_TYPE_SYNC_DIAGNOSIS              0x00300000u
 #define OTD_IOCTL_CODE_TYPE_SYNC_RAWTOUCH               0x00310000u
@@ -55,6 +138,52 @@ OtdReportPacketMultiTouch;
 
 #define OTD_IOCTL_CODE_LENGTH_MASK                      0x0000ffffu
 
+// flags OR'ed into the control code
+#define OTD_IOCTL_CODE_FLAG_MASK                        0xff000000u
+// SYNC_MULTITOUCH_BATCH: report only the newest frame, plus the lifts the skipped frames contained
+#define OTD_IOCTL_CODE_FLAG_LATEST_ONLY                 0x01000000u
+// SET_REPORT/GET_REPORT: queue the transfer and return at once, the length
+// is limited to 4096. poll() reports EPOLLPRI once it has completed and
+// GET_CONTROL_RESULT collects the outcome; until then further control
+// transfers fail with EBUSY.
+#define OTD_IOCTL_CODE_FLAG_ASYNC                       0x02000000u
+// SET_REPORT/GET_REPORT, synchronous only: the transfer queries a read-only
+// block. The SET_REPORT selecting it and the GET_REPORT reading it back are
+// answered by the driver once the block has been read with the same payload
+// and length. An asynchronous GET_REPORT fails with EBUSY while a selection
+// answered this way has not gone to the device; a synchronous GET_REPORT
+// sends it first.
+#define OTD_IOCTL_CODE_FLAG_CACHED                      0x04000000u
+
+// SET_READ_FORMAT: passed in the length field
+#define OTD_READ_FORMAT_RAW                             0
+// read() returns an OtdReportHeader followed by the report
+#define OTD_READ_FORMAT_TIMESTAMPED                     1
+
+// Raw report capture: what read() returns in READ_FORMAT_TIMESTAMPED, one
+// OtdReportHeader followed by length bytes of report per record, e.g. taken
+// by a listener. Writing a capture to <debugfs>/<module>/<interface>/replay
+// queues its reports again as if the device had sent them, spaced like their
+// timestamps divided by replay_speed percent next to it; 100 keeps the
+// original pace, 0 replays as fast as possible.
+
+// Opening the device node for writing makes the caller the primary: it owns
+// mmap() and the SET_REPORT/GET_REPORT/SYNC_* control codes. There is one
+// primary at a time, another open for writing fails with EBUSY until it has
+// closed. O_RDONLY openers are listeners with their own position in the
+// report stream, they may only use SET_READ_FORMAT, GET_OVERFLOW and
+// CLAIM_PRIMARY, so a capture tool never keeps a restarted server from
+// becoming the primary. CLAIM_PRIMARY makes an O_RDONLY opener the primary
+// while there is none and fails with EBUSY otherwise.
+// GET_OVERFLOW returns the reports the caller lost, the ring overflow count
+// for the primary and the reports overwritten before it read them for a
+// listener.
+
+// GET_CONTROL_RESULT returns EAGAIN while an asynchronous transfer is in
+// flight and ENODATA without one. Otherwise it returns the result of the
+// transfer, the length transferred or an error, and copies the data a
+// GET_REPORT read to the argument, up to the length field.
+
 #define OTD_IOCTL_CODE(type, length)                    (((type) & OTD_IOCTL_CODE_TYPE_MASK) | ((length) & OTD_IOCTL_CODE_LENGTH_MASK))
 
 #endif // _OTD_DRV_H_